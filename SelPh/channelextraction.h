@@ -0,0 +1,111 @@
+#ifndef CHANNELEXTRACTION_H
+#define CHANNELEXTRACTION_H
+
+#include <cstddef>
+#include <Eigen/Core>
+#include <QImage>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ChannelExtraction
+{
+
+namespace internal
+{
+
+#if defined(__SSE2__)
+// Convert four 8-bit values (stored in 32-bit lanes) into normalized values
+inline void store4(const __m128i& v, double* dst)
+{
+    const __m128d scale = _mm_set1_pd(255.0);
+    _mm_storeu_pd(dst + 0, _mm_div_pd(_mm_cvtepi32_pd(v), scale));
+    _mm_storeu_pd(dst + 2, _mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2))), scale));
+}
+
+inline void store4(const __m128i& v, float* dst)
+{
+    _mm_storeu_ps(dst, _mm_div_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(255.0f)));
+}
+
+template<typename Scalar>
+inline void store4Pixels(const __m128i& pixels, Scalar* r, Scalar* g, Scalar* b)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    store4(_mm_and_si128(_mm_srli_epi32(pixels, 16), mask), r);
+    store4(_mm_and_si128(_mm_srli_epi32(pixels,  8), mask), g);
+    store4(_mm_and_si128(pixels, mask), b);
+}
+#endif
+
+template<typename Scalar>
+inline void store1Pixel(const QRgb pixel, Scalar* r, Scalar* g, Scalar* b)
+{
+    *r = static_cast<Scalar>(qRed(pixel))   / static_cast<Scalar>(255.0);
+    *g = static_cast<Scalar>(qGreen(pixel)) / static_cast<Scalar>(255.0);
+    *b = static_cast<Scalar>(qBlue(pixel))  / static_cast<Scalar>(255.0);
+}
+
+}
+
+// Extract the normalized RGB channels of the image into column-major h-by-w matrices. The image is read
+// scanline by scanline; eight scanlines are processed together so that each column of the outputs is
+// written in contiguous chunks (i.e., one cache line for double) instead of one element at a time.
+// Scalar can be float to halve the memory of the outputs when double precision is not required.
+template<typename Scalar>
+void extractRgbChannels(const QImage& image,
+                        Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>* r,
+                        Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>* g,
+                        Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>* b)
+{
+    const bool   isPacked = image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32;
+    const QImage source   = isPacked ? image : image.convertToFormat(QImage::Format_RGB32);
+
+    const int w = source.width();
+    const int h = source.height();
+
+    r->resize(h, w);
+    g->resize(h, w);
+    b->resize(h, w);
+
+    Scalar* r_data = r->data();
+    Scalar* g_data = g->data();
+    Scalar* b_data = b->data();
+
+    int y = 0;
+
+#if defined(__SSE2__)
+    const int tileHeight = 8;
+    for (; y + tileHeight <= h; y += tileHeight)
+    {
+        const QRgb* lines[tileHeight];
+        for (int i = 0; i < tileHeight; ++ i) lines[i] = reinterpret_cast<const QRgb*>(source.constScanLine(y + i));
+
+        for (int x = 0; x < w; ++ x)
+        {
+            const std::ptrdiff_t offset = static_cast<std::ptrdiff_t>(x) * h + y;
+
+            const __m128i upper = _mm_set_epi32(lines[3][x], lines[2][x], lines[1][x], lines[0][x]);
+            const __m128i lower = _mm_set_epi32(lines[7][x], lines[6][x], lines[5][x], lines[4][x]);
+
+            internal::store4Pixels(upper, r_data + offset + 0, g_data + offset + 0, b_data + offset + 0);
+            internal::store4Pixels(lower, r_data + offset + 4, g_data + offset + 4, b_data + offset + 4);
+        }
+    }
+#endif
+
+    // Remaining scanlines (or all the scanlines when SSE2 is not available)
+    for (; y < h; ++ y)
+    {
+        const QRgb* line = reinterpret_cast<const QRgb*>(source.constScanLine(y));
+        for (int x = 0; x < w; ++ x)
+        {
+            const std::ptrdiff_t offset = static_cast<std::ptrdiff_t>(x) * h + y;
+            internal::store1Pixel(line[x], r_data + offset, g_data + offset, b_data + offset);
+        }
+    }
+}
+
+}
+
+#endif // CHANNELEXTRACTION_H
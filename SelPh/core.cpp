@@ -6,13 +6,15 @@
 #include <cstring>
 #include <ctime>
 #include <Eigen/SVD>
+#include <QImageReader>
 #include <enhancer/enhancerwidget.hpp>
 #include <imagedistance.hpp>
-#include <mathtoolbox/classical-mds.hpp>
+#include <parallel-util.hpp>
 #include "mainwindow.h"
 #include "image.h"
 #include "eigenutility.h"
 #include "metriclearning.h"
+#include "utility.h"
 
 using std::vector;
 using std::pair;
@@ -25,6 +27,9 @@ Core::Core() :
     featureDim(5),
     nReferencePhotos(10),
     currentIndex(0),
+    useStreamingImport(true),
+    useFeatureCache(true),
+    nImportThreads(0),
     isBaselineMode(false),
     uiSize(0),
     useVisualization(true),
@@ -32,9 +37,23 @@ Core::Core() :
     useInitialOptimization(false),
     useSortingPhotos(false),
     nIterations(1),
-    gradationResolution(40)
+    truncationTolerance(0.0),
+    useFloatDistanceExport(false),
+    useTextDistanceExport(false),
+    gradationResolution(40),
+    nIngested(0),
+    isComputingRow(false),
+    isResizeRequested(false),
+    isIngestionCanceled(false)
 {
     srand(time(NULL));
+
+    goodnessFunctionSnapshot = std::make_shared<const GoodnessFunction>(goodnessFunction);
+}
+
+Core::~Core()
+{
+    cancelIngestion();
 }
 
 void Core::setParameters(const std::vector<double>& parameters)
@@ -74,47 +93,30 @@ void Core::setReferencePhotos()
 namespace
 {
 
-inline vector<double> computeDistanceBetweenImages(const shared_ptr<Image> a, const shared_ptr<Image> b)
-{
-    const Eigen::VectorXd distance_vector = imagedistance::CalcDistances(*(a->getHistogram()), *(b->getHistogram()));
-
-    assert(distance_vector.size() == 38);
-
-    vector<double> d(38);
-    std::memcpy(d.data(), distance_vector.data(), sizeof(double) * 38);
-
-    return d;
-}
-
-inline Core::Distance computeImageDistances(const vector<shared_ptr<Image>>& images)
+// Photos whose format cannot be recognized (including the files that cannot be opened) are dropped with a
+// message before they are assigned indices, so that they never enter the containers with a null preview
+vector<string> selectReadablePhotos(const vector<string>& filePaths)
 {
-    const unsigned n = images.size();
-    Core::Distance D_images(n);
-    for (unsigned i = 0; i < n; ++ i)
+    vector<string> readablePaths;
+    for (const string& filePath : filePaths)
     {
-        D_images[i].resize(n);
-        for (unsigned j = 0; j < n; ++ j)
-        {
-            D_images[i][j] = computeDistanceBetweenImages(images[i], images[j]);
-        }
+        QImageReader reader(QString::fromStdString(filePath));
+        if (reader.canRead()) readablePaths.push_back(filePath);
+        else std::cerr << "Skipped " << filePath << ": " << reader.errorString().toStdString() << std::endl;
     }
-    return D_images;
+    return readablePaths;
 }
 
-inline MatrixXd computeParameterDistances(const vector<VectorXd>& params)
+inline void computeDistanceBetweenImages(const shared_ptr<Image> a, const shared_ptr<Image> b, double* d)
 {
-    const unsigned n = params.size();
-    MatrixXd D(n, n);
-    for (unsigned i = 0; i < n; ++ i) for (unsigned j = i; j < n; ++ j)
-    {
-        const double d = (params[i] - params[j]).norm();
-        D(i, j) = d;
-        D(j, i) = d;
-    }
-    return D;
+    const Eigen::VectorXd distance_vector = imagedistance::CalcDistances(*(a->getHistogram()), *(b->getHistogram()));
+
+    assert(distance_vector.size() == DistanceTensor::dim);
+
+    std::memcpy(d, distance_vector.data(), sizeof(double) * DistanceTensor::dim);
 }
 
-MatrixXd correctRotation(const MatrixXd& X, const vector<shared_ptr<Image>>& images)
+MatrixXd computeRotation(const MatrixXd& X, const vector<shared_ptr<Image>>& images)
 {
     // Find the optimal rotation
     MatrixXd A = MatrixXd::Zero(X.rows(), X.rows());
@@ -125,8 +127,7 @@ MatrixXd correctRotation(const MatrixXd& X, const vector<shared_ptr<Image>>& ima
         A += p * q.transpose();
     }
     Eigen::JacobiSVD<MatrixXd> svd(A, Eigen::ComputeFullU);
-    MatrixXd R = svd.matrixU();
-    return R * X;
+    return svd.matrixU();
 }
 
 }
@@ -134,54 +135,47 @@ MatrixXd correctRotation(const MatrixXd& X, const vector<shared_ptr<Image>>& ima
 void Core::computeMDS()
 {
     // set the distance matrix
-    unsigned n = currentIndex + 1;
-    D.resize(n, n);
-    for (unsigned i = 0; i < n; ++ i)
-    {
-        for (unsigned j = i; j < n; ++ j)
-        {
-            const double d  = computeDistance(alpha, distance, i, j);
-            const double d2 = d * d;
-
-            // Note: D needs to have the squared norms for MDS
-            D(i, j) = d2;
-            D(j, i) = d2;
-        }
-    }
+    const unsigned n = currentIndex + 1;
+    mdsEngine.setDistances(distance, alpha, n);
 
     // Compute the MDS algorithm
 #ifdef TIME
     const auto t1 = system_clock::now();
 #endif
-    const MatrixXd X = mathtoolbox::ComputeClassicalMds(D, std::min<unsigned>(featureDim, D.rows()));
+    const MatrixXd X = mdsEngine.compute(std::min<unsigned>(featureDim, n));
 #ifdef TIME
     const auto t2 = system_clock::now();
-    std::cout << "Metric MDS: " << duration_cast<milliseconds>(t2 - t1).count() << " [ms]" << std::endl;
+    std::cout << "Metric MDS: " << duration_cast<milliseconds>(t2 - t1).count() << " [ms] (" << mdsEngine.getNumIterations() << " iterations)" << std::endl;
 #endif
 
     // Correct the rotation (optional)
-    const MatrixXd Y = (featureDim == 2 && n > 2) ? correctRotation(X, images) : X;
+    const MatrixXd R = (featureDim == 2 && n > 2) ? computeRotation(X, images) : MatrixXd::Identity(X.rows(), X.rows());
+    const MatrixXd Y = R * X;
 
     // set the results to the images
     for (unsigned i = 0; i < n; ++ i)
     {
         images[i]->setFeatureVector(Y.col(i));
     }
-}
 
-void Core::computeMetricLearning()
-{
-    // If this is the first time to compute, initialize the alpha
-    if (alpha.rows() != 38)
+    // Place the rest of the (already ingested) photos by the out-of-sample extension
+    const unsigned nIngested = getNumIngestedImages();
+    if (nIngested > n)
     {
-        alpha = VectorXd::Zero(38);
+        parallelutil::parallel_for(nIngested - n, [&](int k)
+        {
+            images[n + k]->setFeatureVector(R * mdsEngine.embed(distance, n + k));
+        });
     }
+}
 
-    // Prepare distances
-    const MatrixXd D_params = computeParameterDistances(goodnessFunction.pList); // TODO: This can be incrementally updated
+void Core::computeMetricLearning()
+{
+    // Accumulate the pairs of the newly edited photos
+    metricLearningEquations.update(distance, goodnessFunction.pList);
 
     // Compute the metric learning
-    alpha = MetricLearning::computeMetricLearning(distance, D_params, alpha, goodnessFunction.pList.size());
+    alpha = MetricLearning::computeMetricLearning(metricLearningEquations);
 }
 
 void Core::initialize(const string& dirPath)
@@ -189,12 +183,19 @@ void Core::initialize(const string& dirPath)
     // Prepare working directories
     generateDirectories();
 
-    // Import photos
-    importPhotos(dirPath);
+    // Load the features computed in the previous sessions
+    if (useFeatureCache) featureCache.load(Utility::getCacheDirectory());
 
-    // Compute (unlearned) distances between photos
-    distance = computeImageDistances(images);
-    exportRawDistance();
+    // Start importing photos and computing (unlearned) distances between them in background
+    vector<string> filePaths;
+    for (const string& s : Utility::getPhotoFileList(dirPath)) filePaths.push_back(dirPath + s);
+    filePaths = selectReadablePhotos(filePaths);
+    images.assign(filePaths.size(), nullptr);
+    distance.resize(filePaths.size());
+    ingestionThreads.push_back(std::thread(&Core::ingestPhotos, this, filePaths, 0));
+
+    // Wait for the photos required to start the session
+    waitForIngestion(useStreamingImport ? currentIndex + 1 : images.size());
 
     // Set the first photo to the UI
     previewWidget->setImage(*images[currentIndex]->getScaledQImage());
@@ -213,6 +214,123 @@ void Core::initialize(const string& dirPath)
     time_point = std::chrono::system_clock::now();
 }
 
+void Core::addPhotos(const vector<string>& selectedPaths)
+{
+    const vector<string> filePaths = selectReadablePhotos(selectedPaths);
+    if (filePaths.empty()) return;
+
+    const unsigned offset = images.size();
+    const unsigned n      = offset + filePaths.size();
+
+    // The containers are extended between two rows of the ongoing ingestion (if any); the importers
+    // write the photos only while holding the mutex, so they are excluded as well
+    // Note: the learned metric (alpha), the goodness function, and the embedding of the edited photos
+    // are not affected; only the distances between the new photos and all the others are computed
+    {
+        std::unique_lock<std::mutex> lock(ingestionMutex);
+        isResizeRequested = true;
+        ingestionCondition.wait(lock, [&]() { return !isComputingRow; });
+
+        images.resize(n, nullptr);
+        distance.resize(n);
+        studyData.resize(n);
+
+        isResizeRequested = false;
+    }
+    ingestionCondition.notify_all();
+
+    // The new photos are ingested after the preceding ones, which may still be in progress
+    ingestionThreads.push_back(std::thread(&Core::ingestPhotos, this, filePaths, offset));
+}
+
+void Core::ingestPhotos(const vector<string>& filePaths, unsigned offset)
+{
+    const unsigned n = offset + filePaths.size();
+
+    // Decode the photos on the worker pool
+    std::thread importer(&Core::importPhotos, this, filePaths, offset);
+
+    // Compute the distances in the order of the file list as the photos arrive (and after the photos of
+    // the preceding batches); the containers are not extended while a row is being computed
+    for (unsigned i = offset; i < n; ++ i)
+    {
+        {
+            std::unique_lock<std::mutex> lock(ingestionMutex);
+            ingestionCondition.wait(lock, [&]() { return (nIngested == i && images[i] != nullptr && !isResizeRequested) || isIngestionCanceled; });
+            if (isIngestionCanceled) break;
+            isComputingRow = true;
+        }
+
+        computeDistanceRow(i);
+
+        // The last photo is published only after the export and the cache are done, since the photos and
+        // the distances may be reordered (see useSortingPhotos) as soon as all of them are ingested
+        if (i + 1 == n)
+        {
+            if (n == images.size()) exportRawDistance();
+
+            // Store the newly computed features for the next sessions
+            if (useFeatureCache)
+            {
+                for (unsigned k = offset; k < n; ++ k) featureCache.storePhoto(images[k]->getContentHash());
+                featureCache.save();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(ingestionMutex);
+            nIngested      = i + 1;
+            isComputingRow = false;
+        }
+        ingestionCondition.notify_all();
+
+        if (importProgressCallback) importProgressCallback(i + 1, n);
+    }
+    importer.join();
+}
+
+// Compute the distances between the photo and the preceding ones in parallel. These pairs are
+// contiguous in the distance tensor. Only the pairs that are not found in the cache are computed
+// (and then stored in the cache).
+void Core::computeDistanceRow(unsigned index)
+{
+    const string& hash = images[index]->getContentHash();
+    parallelutil::parallel_for(index, [&](int j)
+    {
+        double* d = distance.getPairData(Distance::getPairIndex(j, index));
+        if (!useFeatureCache || !featureCache.findDistance(hash, images[j]->getContentHash(), d))
+        {
+            computeDistanceBetweenImages(images[index], images[j], d);
+            if (useFeatureCache) featureCache.storeDistance(hash, images[j]->getContentHash(), d);
+        }
+    });
+}
+
+void Core::cancelIngestion()
+{
+    {
+        std::lock_guard<std::mutex> lock(ingestionMutex);
+        isIngestionCanceled = true;
+    }
+    ingestionCondition.notify_all();
+    for (std::thread& thread : ingestionThreads) thread.join();
+    ingestionThreads.clear();
+}
+
+unsigned Core::getNumIngestedImages() const
+{
+    std::lock_guard<std::mutex> lock(ingestionMutex);
+    return nIngested;
+}
+
+void Core::waitForIngestion(unsigned n)
+{
+    n = std::min<unsigned>(n, images.size());
+
+    std::unique_lock<std::mutex> lock(ingestionMutex);
+    ingestionCondition.wait(lock, [&]() { return nIngested >= n || isIngestionCanceled; });
+}
+
 VectorXd Core::getCurrentFeatureVector() const
 {
     return images[currentIndex]->getFeatureVector();
@@ -264,6 +382,9 @@ bool Core::goNext()
     // Go next
     currentIndex ++;
 
+    // Wait for the background ingestion if the next photo is not ready yet (sorting needs all the photos)
+    waitForIngestion(useSortingPhotos ? images.size() : currentIndex + 1);
+
 #ifdef TIME
     auto t1 = std::chrono::system_clock::now();
 #endif
@@ -287,8 +408,10 @@ bool Core::goNext()
     }
 
     // Compute the adaptive kernel density estimation
+    goodnessFunction.truncationTolerance = truncationTolerance;
     goodnessFunction.computeCovariance();
     goodnessFunction.regularizeCovariance();
+    goodnessFunctionSnapshot = std::make_shared<const GoodnessFunction>(goodnessFunction);
 
 #ifdef TIME
     auto t2 = std::chrono::system_clock::now();
@@ -312,6 +435,9 @@ bool Core::goNext()
         const auto tmp = images[currentIndex];
         images[currentIndex] = images[optimalIndex];
         images[optimalIndex] = tmp;
+
+        // The distances follow the photos
+        distance.swap(currentIndex, optimalIndex);
     }
 
     const shared_ptr<Image> nextImage = images[currentIndex];
@@ -320,9 +446,12 @@ bool Core::goNext()
     confidence = computeConfidence(currentIndex);
     mainWindow->updateConfidenceValueInUI(confidence);
 
-    // compute local/global best/worst values
-    localMax  = goodnessFunction.getValue(goodnessFunction.getBestParameterSet(getCurrentFeatureVector()), getCurrentFeatureVector());
-    localMin  = goodnessFunction.getValue(goodnessFunction.getBestParameterSet(getCurrentFeatureVector(), true), getCurrentFeatureVector());
+    // compute local/global best/worst values (the two searches share one parallel loop)
+    const VectorXd f = getCurrentFeatureVector();
+    VectorXd best, worst;
+    goodnessFunction.getBestAndWorstParameterSets(f, best, worst);
+    localMax  = goodnessFunction.getValue(best, f);
+    localMin  = goodnessFunction.getValue(worst, f);
 
     // Compute optimal parameters for the next photo
     const VectorXd opt = goodnessFunction.getBestParameterSet(getCurrentFeatureVector());
@@ -5,9 +5,19 @@
 #include <iostream>
 #include <memory>
 #include <chrono>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <Eigen/Core>
 #include "studydata.h"
 #include "goodnessfunction.h"
+#include "originalimagecache.h"
+#include "featurecache.h"
+#include "distancetensor.h"
+#include "metriclearning.h"
+#include "mdsengine.h"
 
 class MainWindow;
 class Image;
@@ -18,6 +28,7 @@ class Core
 {
 public:
     Core();
+    ~Core();
 
     static Core& getInstance()
     {
@@ -30,23 +41,18 @@ public:
     const int featureDim;
 
     // This member is computed in the initialization stage only once
-    typedef std::vector<std::vector<std::vector<double>>> Distance;
+    typedef DistanceTensor Distance;
     Distance distance;
 
     static double computeDistance(const Eigen::VectorXd& alpha, const Distance& D, unsigned index1, unsigned index2)
     {
-        double d = 0.0;
-        const unsigned n = alpha.rows();
-        for (unsigned i = 0; i < n; ++ i)
-        {
-            d += alpha(i) * D[index1][index2][i];
-        }
-        return d;
+        return index1 == index2 ? 0.0 : alpha.dot(D.getPair(Distance::getPairIndex(index1, index2)));
     }
 
     // for metric learning
     Eigen::VectorXd alpha;
     void computeMetricLearning();
+    MetricLearning::NormalEquations metricLearningEquations;
 
     // user interface
     MainWindow* mainWindow;
@@ -59,9 +65,32 @@ public:
     // image managements
     unsigned currentIndex;
     void initialize(const std::string& dirPath);
-    std::vector<std::shared_ptr<Image>> images;
+    std::vector<std::shared_ptr<Image>> images; // nullptr until the photo is imported
     Eigen::VectorXd getCurrentFeatureVector() const;
 
+    // In the streaming mode, the session starts as soon as the first photo is ingested (i.e., imported and
+    // its distances to the preceding photos are computed) and the rest are ingested in background
+    bool     useStreamingImport;
+    unsigned getNumIngestedImages() const;
+    void     waitForIngestion(unsigned n);
+    void     cancelIngestion();
+
+    // Append photos to the running session (the photos are ingested in the same way as the initial ones).
+    // This extends the containers, so it must be called from the thread that reads them (i.e., the GUI
+    // thread); it does not wait for the new photos to be ingested.
+    void addPhotos(const std::vector<std::string>& filePaths);
+
+    // Full-resolution photos are decoded lazily through this cache (the capacity is in photos, the budget in bytes)
+    OriginalImageCache originalImageCache;
+
+    // Histograms and distances computed in the previous sessions are reused through this cache
+    FeatureCache featureCache;
+    bool         useFeatureCache;
+
+    // Called from worker threads during the import as (number of imported photos, number of all photos)
+    std::function<void(unsigned, unsigned)> importProgressCallback;
+    unsigned nImportThreads;                    // 0 means the number of hardware threads
+
     // for visualization management
     double localMax;
     double localMin;
@@ -90,12 +119,24 @@ public:
     bool useVisualization;
     bool useOptimization;
     bool useInitialOptimization;
-    bool useSortingPhotos;       // This will never be used (always false)
+    bool useSortingPhotos;       // Edit the most confident photo next (requires all the photos to be ingested)
 
     int nIterations;
 
+    // Kernels of the goodness function whose values cannot exceed this tolerance are skipped in its evaluation
+    // (see GoodnessFunction::truncationTolerance); 0 means the exact evaluation
+    double truncationTolerance;
+
+    // The raw distances are exported in the binary format (see DistanceTensor::exportBinary) by default
+    bool useFloatDistanceExport;
+    bool useTextDistanceExport; // for debugging
+
     GoodnessFunction goodnessFunction;
 
+    // An immutable copy of the goodness function published once per model update, so that it can be read
+    // by background workers (e.g., for the heat-maps) while the goodness function above is updated
+    std::shared_ptr<const GoodnessFunction> getGoodnessFunctionSnapshot() const { return goodnessFunctionSnapshot; }
+
     int gradationResolution;
 
     void optimizeParameters(int exclusiveParameter);
@@ -110,14 +151,27 @@ private:
 
     std::vector<double> parameters_;
 
+    std::shared_ptr<const GoodnessFunction> goodnessFunctionSnapshot;
+
     // Multi-dimensional scaling
-    Eigen::MatrixXd D;
-    void computeMDS();
+    MdsEngine mdsEngine;
+    void      computeMDS();
 
     void setReferencePhotos();
 
+    // Background ingestion of photos
+    void ingestPhotos(const std::vector<std::string>& filePaths, unsigned offset);
+    void computeDistanceRow(unsigned index);
+    std::vector<std::thread> ingestionThreads;  // one per batch of photos; the rows are computed in order
+    mutable std::mutex       ingestionMutex;
+    std::condition_variable  ingestionCondition;
+    unsigned                 nIngested;
+    bool                     isComputingRow;     // an ingestion thread is accessing the photos and the distances
+    bool                     isResizeRequested;  // addPhotos is waiting to extend the photos and the distances
+    std::atomic<bool>        isIngestionCanceled;
+
     // Export / Import methods
-    void importPhotos(const std::string& dirPath);
+    void importPhotos(const std::vector<std::string>& filePaths, unsigned offset);
     bool finishTask() const;
     void exportMap() const;
     void exportRawDistance() const;
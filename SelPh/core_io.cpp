@@ -2,6 +2,7 @@
 
 #include <fstream>
 #include <ctime>
+#include <algorithm>
 #include <QDir>
 #include "utility.h"
 #include "image.h"
@@ -46,7 +47,9 @@ void Core::generateDirectories()
 
 void Core::printFeatureCoordinates(ostream& stream) const
 {
-    for (unsigned i = 0; i < images.size(); ++ i)
+    // Photos that are still being ingested are not printed
+    const unsigned n = getNumIngestedImages();
+    for (unsigned i = 0; i < n; ++ i)
     {
         const shared_ptr<Image> image = images[i];
         stream << i << "," << image->getFileName();
@@ -58,14 +61,48 @@ void Core::printFeatureCoordinates(ostream& stream) const
     }
 }
 
-void Core::importPhotos(const string& dirPath)
+// Each worker pulls the next photo and pushes it through the stages; the results are stored by their
+// indices (after the offset) so that the order of the images is the same as the order of the file list
+void Core::importPhotos(const vector<string>& filePaths, unsigned offset)
 {
-    const vector<string> fileList = Utility::getPhotoFileList(dirPath);
-    for (const string& s : fileList)
+    const unsigned n = filePaths.size();
+
+    const unsigned nHardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    const unsigned nThreads         = std::min(n, nImportThreads != 0 ? nImportThreads : nHardwareThreads);
+
+    std::atomic<unsigned> nextIndex(0);
+
+    auto work = [&]()
     {
-        cout << "Importing " << s << " ..." << endl;
-        images.push_back(make_shared<Image>(dirPath + s));
-    }
+        for (unsigned i = nextIndex ++; i < n && !isIngestionCanceled; i = nextIndex ++)
+        {
+            Image::ImportTask task;
+            task.fileName = filePaths[i];
+
+            Image::decode(task);
+            Image::rescale(task);
+
+            // Photos known by the feature cache can skip the histogram stages; their histograms are
+            // computed on demand only if some of their distances are missing
+            if (!useFeatureCache || !featureCache.containsPhoto(task.contentHash))
+            {
+                Image::extractChannels(task);
+                Image::computeHistogram(task);
+            }
+
+            const shared_ptr<Image> image = make_shared<Image>(task);
+            {
+                std::lock_guard<std::mutex> lock(ingestionMutex);
+                images[offset + i] = image;
+                cout << "Imported " << filePaths[i] << endl;
+            }
+            ingestionCondition.notify_all();
+        }
+    };
+
+    vector<std::thread> threads;
+    for (unsigned t = 0; t < nThreads; ++ t) threads.push_back(std::thread(work));
+    for (std::thread& thread : threads) thread.join();
 }
 
 void Core::exportMap() const
@@ -81,17 +118,24 @@ void Core::exportMap() const
 void Core::exportRawDistance() const
 {
     // Dir name
-    const string dirName = workingDirectoryPath + "/study/raw_distance.txt";
+    const string dirName = workingDirectoryPath + "/study/";
 
     // Output
-    ofstream file(dirName);
-    for (vector<vector<double>> tmp1 : distance)
+    distance.exportBinary(dirName + "raw_distance.bin", useFloatDistanceExport);
+
+    if (!useTextDistanceExport) return;
+
+    // Output (the full n-by-n-by-38 tensor including the symmetric pairs)
+    ofstream file(dirName + "raw_distance.txt");
+    const unsigned n = distance.size();
+    for (unsigned i = 0; i < n; ++ i)
     {
-        for (vector<double> tmp2 : tmp1)
+        for (unsigned j = 0; j < n; ++ j)
         {
-            for (double tmp3 : tmp2)
+            const Eigen::VectorXd d = distance.getDistanceVector(i, j);
+            for (unsigned k = 0; k < d.rows(); ++ k)
             {
-                file << tmp3 << ",";
+                file << d(k) << ",";
             }
         }
     }
@@ -112,6 +156,7 @@ bool Core::finishTask() const
         data.exportModifiedScaledPhoto(workingDirectoryPath);
         data.exportModifiedOriginalPhoto(workingDirectoryPath);
     }
+    originalImageCache.printStatistics();
 
     // export the actual parameters
     ofstream param(workingDirectoryPath + "/study/params.txt");
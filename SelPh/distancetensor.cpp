@@ -0,0 +1,245 @@
+#include "distancetensor.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <utility>
+#include <QFile>
+#include <parallel-util.hpp>
+
+namespace
+{
+const std::size_t cacheLineSize = 64;
+
+const char          binaryMagic[8] = { 'S', 'E', 'L', 'P', 'H', 'D', 'T', '\0' };
+const std::uint32_t binaryVersion  = 1;
+
+// Limits of the binary format; with these, the number of pairs and the payload size fit in 64 bits (and
+// getNumPairs() cannot overflow even with a 32-bit size_t)
+const std::uint32_t maxBinaryPhotos = 1u << 16;
+const std::uint32_t maxBinaryStride = 1024;
+
+// Header of the binary format (64 bytes)
+struct BinaryHeader
+{
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t headerSize;
+    std::uint32_t nPhotos;
+    std::uint32_t dim;
+    std::uint32_t stride;       // the number of scalars per pair (including the padding)
+    std::uint32_t scalarSize;   // 4 (float) or 8 (double)
+    std::uint64_t nPairs;       // packed pairs (i < j) stored at j (j - 1) / 2 + i
+    std::uint8_t  reserved[24];
+};
+static_assert(sizeof(BinaryHeader) == 64, "The header should be 64 bytes");
+
+inline double* alignToCacheLine(double* ptr)
+{
+    const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(ptr);
+    const std::uintptr_t aligned = (address + cacheLineSize - 1) & ~static_cast<std::uintptr_t>(cacheLineSize - 1);
+    return reinterpret_cast<double*>(aligned);
+}
+}
+
+DistanceTensor::DistanceTensor(unsigned n) : n(0), data(nullptr)
+{
+    resize(n);
+}
+
+DistanceTensor::DistanceTensor(const DistanceTensor& other) : n(0), data(nullptr)
+{
+    *this = other;
+}
+
+DistanceTensor& DistanceTensor::operator=(const DistanceTensor& other)
+{
+    // Note: the buffer cannot be copied as is because the aligned head depends on its address
+    if (this == &other) return *this;
+    this->n = 0;
+    resize(other.n);
+    std::copy(other.data, other.data + getNumPairs() * stride, data);
+    return *this;
+}
+
+DistanceTensor::DistanceTensor(DistanceTensor&& other) : n(0), data(nullptr)
+{
+    *this = std::move(other);
+}
+
+DistanceTensor& DistanceTensor::operator=(DistanceTensor&& other)
+{
+    if (this == &other) return *this;
+    buffer = std::move(other.buffer);
+    data   = other.data;
+    n      = other.n;
+
+    other.buffer.clear();
+    other.data = nullptr;
+    other.n    = 0;
+    return *this;
+}
+
+void DistanceTensor::resize(unsigned n)
+{
+    const std::size_t nPairs    = getNumPairs(n);
+    const std::size_t nOldPairs = std::min(getNumPairs(this->n), nPairs);
+
+    // Allocate a new buffer with a margin for the alignment
+    std::vector<double> newBuffer(nPairs * stride + cacheLineSize / sizeof(double), 0.0);
+    double*             newData = alignToCacheLine(newBuffer.data());
+
+    if (nOldPairs != 0) std::copy(data, data + nOldPairs * stride, newData);
+
+    buffer.swap(newBuffer);
+    data    = newData;
+    this->n = n;
+}
+
+void DistanceTensor::swap(unsigned index1, unsigned index2)
+{
+    if (index1 == index2) return;
+
+    // Note: the pair (index1, index2) itself is unchanged
+    for (unsigned k = 0; k < n; ++ k)
+    {
+        if (k == index1 || k == index2) continue;
+
+        double* pair1 = getPairData(getPairIndex(index1, k));
+        double* pair2 = getPairData(getPairIndex(index2, k));
+        std::swap_ranges(pair1, pair1 + dim, pair2);
+    }
+}
+
+Eigen::VectorXd DistanceTensor::getDistanceVector(unsigned index1, unsigned index2) const
+{
+    if (index1 == index2) return Eigen::VectorXd::Zero(dim);
+    return getPair(getPairIndex(index1, index2));
+}
+
+Eigen::VectorXd DistanceTensor::computeWeightedDistances(const Eigen::VectorXd& alpha, unsigned n) const
+{
+    assert(alpha.rows() == dim);
+
+    const std::size_t   nPairs    = getNumPairs(n);
+    const ConstPairsMap pairs     = getPairs(n);
+    const std::size_t   blockSize = 1 << 14;
+    const std::size_t   nBlocks   = (nPairs + blockSize - 1) / blockSize;
+
+    Eigen::VectorXd distances(nPairs);
+    if (nBlocks <= 1)
+    {
+        distances.noalias() = pairs.transpose() * alpha;
+        return distances;
+    }
+
+    parallelutil::parallel_for(nBlocks, [&](int block)
+    {
+        const std::size_t begin = block * blockSize;
+        const std::size_t size  = std::min(blockSize, nPairs - begin);
+        distances.segment(begin, size).noalias() = pairs.middleCols(begin, size).transpose() * alpha;
+    });
+
+    return distances;
+}
+
+bool DistanceTensor::exportBinary(const std::string& filePath, bool useFloat) const
+{
+    BinaryHeader header;
+    std::memset(&header, 0, sizeof(BinaryHeader));
+    std::memcpy(header.magic, binaryMagic, sizeof(binaryMagic));
+    header.version    = binaryVersion;
+    header.headerSize = sizeof(BinaryHeader);
+    header.nPhotos    = n;
+    header.dim        = dim;
+    header.stride     = useFloat ? dim : stride;
+    header.scalarSize = useFloat ? sizeof(float) : sizeof(double);
+    header.nPairs     = getNumPairs();
+
+    std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+    if (!file || !file.write(reinterpret_cast<const char*>(&header), sizeof(BinaryHeader)))
+    {
+        std::cerr << "Failed to write the header of " << filePath << std::endl;
+        return false;
+    }
+
+    bool isWritten;
+    if (useFloat)
+    {
+        // Drop the padding as well as the precision
+        std::vector<float> values(getNumPairs() * dim);
+        for (std::size_t p = 0; p < getNumPairs(); ++ p)
+        {
+            std::copy(getPairData(p), getPairData(p) + dim, values.begin() + p * dim);
+        }
+        isWritten = bool(file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float)));
+    }
+    else
+    {
+        isWritten = bool(file.write(reinterpret_cast<const char*>(data), getNumPairs() * stride * sizeof(double)));
+    }
+
+    // A short write may only be reported when the buffered data is flushed
+    file.close();
+    if (!isWritten || file.fail())
+    {
+        std::cerr << "Failed to write the distances to " << filePath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool DistanceTensor::importBinary(const std::string& filePath)
+{
+    QFile file(QString::fromStdString(filePath));
+    if (!file.open(QIODevice::ReadOnly) || file.size() < static_cast<qint64>(sizeof(BinaryHeader))) return false;
+
+    const uchar* mapped = file.map(0, file.size());
+    if (mapped == nullptr) return false;
+
+    BinaryHeader header;
+    std::memcpy(&header, mapped, sizeof(BinaryHeader));
+
+    // Every field is bounded before it is used in any product, and the payload size is checked by division,
+    // so that a damaged header can neither overflow the size computation nor make the reads leave the file
+    const std::uint64_t fileSize = static_cast<std::uint64_t>(file.size());
+    const bool isValid =
+        std::equal(binaryMagic, binaryMagic + sizeof(binaryMagic), header.magic) &&
+        header.version == binaryVersion &&
+        header.headerSize == sizeof(BinaryHeader) &&
+        header.dim == dim &&
+        header.stride >= dim && header.stride <= maxBinaryStride &&
+        (header.scalarSize == sizeof(float) || header.scalarSize == sizeof(double)) &&
+        header.nPhotos <= maxBinaryPhotos &&
+        header.nPairs == getNumPairs(header.nPhotos) &&
+        (fileSize - header.headerSize) / (header.stride * header.scalarSize) >= header.nPairs;
+
+    if (!isValid)
+    {
+        std::cerr << "Invalid distance file: " << filePath << std::endl;
+        file.unmap(const_cast<uchar*>(mapped));
+        return false;
+    }
+
+    resize(header.nPhotos);
+
+    const uchar* values = mapped + header.headerSize;
+    for (std::size_t p = 0; p < getNumPairs(); ++ p)
+    {
+        if (header.scalarSize == sizeof(double))
+        {
+            std::memcpy(getPairData(p), values + p * header.stride * sizeof(double), dim * sizeof(double));
+        }
+        else
+        {
+            const float* pair = reinterpret_cast<const float*>(values + p * header.stride * sizeof(float));
+            std::copy(pair, pair + dim, getPairData(p));
+        }
+    }
+
+    file.unmap(const_cast<uchar*>(mapped));
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef DISTANCETENSOR_H
+#define DISTANCETENSOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+
+// Distance vectors between all the pairs of photos. As d(i, j) = d(j, i) and d(i, i) = 0, only the
+// pairs with i < j are stored. The pairs are packed column by column (i.e., pair (i, j) is stored at
+// j (j - 1) / 2 + i), so adding a photo appends its pairs without moving the existing ones. All the
+// pairs live in a single cache-line-aligned buffer, each padded to a multiple of the cache line size.
+class DistanceTensor
+{
+public:
+    enum
+    {
+        dim    = 38,    // the number of distance metrics computed by imagedistance
+        stride = 40     // the padded size of a pair (320 bytes)
+    };
+
+    typedef Eigen::Map<const Eigen::VectorXd, Eigen::Aligned>                            ConstPairMap;
+    typedef Eigen::Map<Eigen::VectorXd, Eigen::Aligned>                                  PairMap;
+    typedef Eigen::Map<const Eigen::MatrixXd, Eigen::Aligned, Eigen::OuterStride<stride>> ConstPairsMap;
+
+    // The aligned head points into the buffer, so a copy re-aligns its own buffer, while a move takes the
+    // buffer over (its address does not change) and leaves the source empty
+    DistanceTensor(unsigned n = 0);
+    DistanceTensor(const DistanceTensor& other);
+    DistanceTensor(DistanceTensor&& other);
+    DistanceTensor& operator=(const DistanceTensor& other);
+    DistanceTensor& operator=(DistanceTensor&& other);
+
+    // Change the number of photos; the existing pairs are preserved
+    void resize(unsigned n);
+
+    unsigned    size()        const { return n; }
+    std::size_t getNumPairs() const { return getNumPairs(n); }
+
+    // Note: n (n - 1) overflows a 32-bit size_t beyond 65536 photos (importBinary rejects such files)
+    static std::size_t getNumPairs(unsigned n) { return n == 0 ? 0 : static_cast<std::size_t>(n) * (n - 1) / 2; }
+
+    // Note: index1 != index2
+    static std::size_t getPairIndex(unsigned index1, unsigned index2)
+    {
+        const unsigned i = std::min(index1, index2);
+        const unsigned j = std::max(index1, index2);
+        return static_cast<std::size_t>(j) * (j - 1) / 2 + i;
+    }
+
+    const double* getPairData(std::size_t pairIndex) const { return data + pairIndex * stride; }
+    double*       getPairData(std::size_t pairIndex)       { return data + pairIndex * stride; }
+
+    ConstPairMap getPair(std::size_t pairIndex) const { return ConstPairMap(getPairData(pairIndex), dim); }
+    PairMap      getPair(std::size_t pairIndex)       { return PairMap(getPairData(pairIndex), dim); }
+
+    // The pairs among the first n photos as a (dim x pairs) matrix (they are contiguous in the buffer)
+    ConstPairsMap getPairs(unsigned n) const { return ConstPairsMap(data, dim, getNumPairs(n)); }
+
+    // Exchange the indices of two photos (i.e., swap their pairs with all the other photos)
+    void swap(unsigned index1, unsigned index2);
+
+    // Note: the distance vector of the same photo (i.e., index1 == index2) is the zero vector
+    Eigen::VectorXd getDistanceVector(unsigned index1, unsigned index2) const;
+
+    // Compute the learned distances (i.e., alpha^T d) of all the pairs among the first n photos at once
+    // as a matrix-vector product; the pairs are split into blocks processed in parallel when there are many
+    Eigen::VectorXd computeWeightedDistances(const Eigen::VectorXd& alpha, unsigned n) const;
+
+    // Binary format: a 64-byte header followed by the packed pairs, so the pairs can be used directly
+    // from a memory-mapped file. The file is written in two bulk writes (the header and the pairs); false is
+    // returned if any of them (or closing the file) fails.
+    bool exportBinary(const std::string& filePath, bool useFloat = false) const;
+    bool importBinary(const std::string& filePath);
+
+private:
+    unsigned            n;
+    std::vector<double> buffer;
+    double*             data;   // the cache-line-aligned head of the buffer
+};
+
+#endif // DISTANCETENSOR_H
@@ -0,0 +1,195 @@
+#include "featurecache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+
+using std::string;
+using std::vector;
+using std::ifstream;
+using std::ofstream;
+using std::uint32_t;
+using std::lock_guard;
+using std::mutex;
+
+namespace
+{
+// File layout: [magic (4 bytes)][histogram version (4 bytes)][distance version (4 bytes)][records ...]
+const char     photoMagic[4]    = { 'S', 'P', 'F', 'P' };
+const char     distanceMagic[4] = { 'S', 'P', 'F', 'D' };
+const unsigned hashSize         = 20; // SHA-1
+const unsigned distanceDim      = 38;
+
+bool readHeader(ifstream& file, const char magic[4])
+{
+    char     m[4];
+    uint32_t versions[2];
+    file.read(m, 4);
+    file.read(reinterpret_cast<char*>(versions), sizeof(versions));
+    return file && std::equal(m, m + 4, magic) && versions[0] == FeatureCache::histogramVersion && versions[1] == FeatureCache::distanceVersion;
+}
+
+// Open the file for appending records; the file is (re)created when it is missing or outdated. A torn
+// record at the end (e.g., after a crash during a save) is truncated so that new records stay aligned.
+bool openForAppend(const string& path, const char magic[4], std::streamoff recordSize, ofstream& file)
+{
+    ifstream existing(path, std::ios::binary | std::ios::ate);
+    const std::streamoff fileSize = existing ? std::streamoff(existing.tellg()) : 0;
+    existing.seekg(0);
+    const bool valid = existing && readHeader(existing, magic);
+    existing.close();
+
+    if (valid)
+    {
+        const std::streamoff headerSize = 4 + 2 * sizeof(uint32_t);
+        const std::streamoff wholeSize  = headerSize + (fileSize - headerSize) / recordSize * recordSize;
+        if (wholeSize != fileSize && !QFile::resize(QString::fromStdString(path), wholeSize))
+        {
+            std::cerr << "Failed to truncate " << path << std::endl;
+            return false;
+        }
+
+        file.open(path, std::ios::binary | std::ios::app);
+        return bool(file);
+    }
+
+    const uint32_t versions[2] = { FeatureCache::histogramVersion, FeatureCache::distanceVersion };
+    file.open(path, std::ios::binary | std::ios::trunc);
+    file.write(magic, 4);
+    file.write(reinterpret_cast<const char*>(versions), sizeof(versions));
+    return bool(file);
+}
+}
+
+string FeatureCache::computeContentHash(const char* data, std::size_t size)
+{
+    const QByteArray hash = QCryptographicHash::hash(QByteArray::fromRawData(data, static_cast<int>(size)), QCryptographicHash::Sha1);
+    assert (hash.size() == hashSize);
+    return string(hash.constData(), hash.size());
+}
+
+string FeatureCache::getPairKey(const string& hash1, const string& hash2)
+{
+    // Distances are symmetric, so the pair is stored only once
+    return hash1 < hash2 ? hash1 + hash2 : hash2 + hash1;
+}
+
+void FeatureCache::load(const string& dirPath)
+{
+    lock_guard<mutex> lock(recordsMutex);
+
+    this->dirPath = dirPath;
+    QDir dir(QString::fromStdString(dirPath));
+    if (!dir.exists()) dir.mkpath(".");
+
+    photos.clear();
+    distances.clear();
+    newPhotos.clear();
+    newDistances.clear();
+
+    ifstream photoFile(dirPath + "/photos.bin", std::ios::binary);
+    if (photoFile && readHeader(photoFile, photoMagic))
+    {
+        string hash(hashSize, '\0');
+        while (photoFile.read(&hash[0], hashSize))
+        {
+            photos.insert(hash);
+        }
+    }
+
+    ifstream distanceFile(dirPath + "/distances.bin", std::ios::binary);
+    if (distanceFile && readHeader(distanceFile, distanceMagic))
+    {
+        string         key(2 * hashSize, '\0');
+        vector<double> d(distanceDim);
+        while (distanceFile.read(&key[0], 2 * hashSize) && distanceFile.read(reinterpret_cast<char*>(d.data()), sizeof(double) * distanceDim))
+        {
+            distances[key] = d;
+        }
+    }
+
+    std::cout << "Feature cache: " << photos.size() << " photos, " << distances.size() << " pairs" << std::endl;
+}
+
+void FeatureCache::save()
+{
+    lock_guard<mutex> lock(recordsMutex);
+
+    if (dirPath.empty()) return;
+
+    if (!newPhotos.empty())
+    {
+        ofstream file;
+        if (openForAppend(dirPath + "/photos.bin", photoMagic, hashSize, file))
+        {
+            for (const string& hash : newPhotos) file.write(hash.data(), hashSize);
+        }
+        newPhotos.clear();
+    }
+
+    if (!newDistances.empty())
+    {
+        ofstream file;
+        if (openForAppend(dirPath + "/distances.bin", distanceMagic, 2 * hashSize + sizeof(double) * distanceDim, file))
+        {
+            for (const string& key : newDistances)
+            {
+                file.write(key.data(), 2 * hashSize);
+                file.write(reinterpret_cast<const char*>(distances.at(key).data()), sizeof(double) * distanceDim);
+            }
+        }
+        newDistances.clear();
+    }
+}
+
+bool FeatureCache::containsPhoto(const string& hash) const
+{
+    if (hash.empty()) return false;
+
+    lock_guard<mutex> lock(recordsMutex);
+    return photos.count(hash) != 0;
+}
+
+void FeatureCache::storePhoto(const string& hash)
+{
+    if (hash.empty()) return;
+
+    lock_guard<mutex> lock(recordsMutex);
+    if (photos.insert(hash).second) newPhotos.push_back(hash);
+}
+
+bool FeatureCache::findDistance(const string& hash1, const string& hash2, double* distance) const
+{
+    if (hash1.empty() || hash2.empty()) return false;
+
+    lock_guard<mutex> lock(recordsMutex);
+    const auto it = distances.find(getPairKey(hash1, hash2));
+    if (it == distances.end()) return false;
+    std::copy(it->second.begin(), it->second.end(), distance);
+    return true;
+}
+
+void FeatureCache::storeDistance(const string& hash1, const string& hash2, const double* distance)
+{
+    if (hash1.empty() || hash2.empty()) return;
+
+    lock_guard<mutex> lock(recordsMutex);
+    const string key = getPairKey(hash1, hash2);
+    if (distances.insert(std::make_pair(key, vector<double>(distance, distance + distanceDim))).second) newDistances.push_back(key);
+}
+
+unsigned FeatureCache::getNumPhotos() const
+{
+    lock_guard<mutex> lock(recordsMutex);
+    return photos.size();
+}
+
+unsigned FeatureCache::getNumDistances() const
+{
+    lock_guard<mutex> lock(recordsMutex);
+    return distances.size();
+}
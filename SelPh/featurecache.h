@@ -0,0 +1,52 @@
+#ifndef FEATURECACHE_H
+#define FEATURECACHE_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// A persistent on-disk cache of the image features. Photos are identified by the hash of their file
+// contents, so the cache stays valid even when photos are renamed or moved to other directories.
+// The whole cache is discarded when the version of the histogram or distance algorithm changes.
+// An empty hash (i.e., a photo that could not be read) is never cached.
+class FeatureCache
+{
+public:
+    // Increment these values whenever the corresponding algorithm in imagedistance changes
+    static const std::uint32_t histogramVersion = 1;
+    static const std::uint32_t distanceVersion  = 1;
+
+    static std::string computeContentHash(const char* data, std::size_t size);
+
+    void load(const std::string& dirPath);
+    void save();
+
+    bool containsPhoto(const std::string& hash) const;
+    void storePhoto(const std::string& hash);
+
+    // The distance is an array of 38 values
+    bool findDistance(const std::string& hash1, const std::string& hash2, double* distance) const;
+    void storeDistance(const std::string& hash1, const std::string& hash2, const double* distance);
+
+    unsigned getNumPhotos()    const;
+    unsigned getNumDistances() const;
+
+private:
+    static std::string getPairKey(const std::string& hash1, const std::string& hash2);
+
+    std::string dirPath;
+
+    std::unordered_set<std::string>                      photos;
+    std::unordered_map<std::string, std::vector<double>> distances;
+
+    // Records that have not been written to the disk yet
+    std::vector<std::string> newPhotos;
+    std::vector<std::string> newDistances;
+
+    mutable std::mutex recordsMutex;
+};
+
+#endif // FEATURECACHE_H
@@ -0,0 +1,48 @@
+#include "fourierfeatures.h"
+
+#include <cassert>
+#include <numeric>
+#include <random>
+
+using namespace Eigen;
+using namespace std;
+
+RandomFourierFeatures::RandomFourierFeatures(const vector<VectorXd>& centers, const vector<MatrixXd>& whitenings, const vector<double>& scales, unsigned nFeatures, unsigned seed)
+{
+    assert(!centers.empty() && centers.size() == whitenings.size() && centers.size() == scales.size());
+
+    const unsigned n = centers[0].rows();
+    const unsigned N = centers.size();
+
+    mt19937                      engine(seed);
+    discrete_distribution<int>   kernelDistribution(scales.begin(), scales.end());
+    normal_distribution<double>  normal(0.0, 1.0);
+
+    frequencies.resize(nFeatures, n);
+    phases.resize(nFeatures);
+    for (unsigned d = 0; d < nFeatures; ++ d)
+    {
+        const unsigned i = kernelDistribution(engine);
+
+        VectorXd z(n);
+        for (unsigned k = 0; k < n; ++ k) z(k) = normal(engine);
+
+        // w = W^T z has the covariance W^T W = S^-1
+        const VectorXd w = whitenings[i].transpose() * z;
+        frequencies.row(d) = w.transpose();
+        phases(d)          = w.dot(centers[i]);
+    }
+
+    scale = accumulate(scales.begin(), scales.end(), 0.0) / static_cast<double>(N) / static_cast<double>(nFeatures);
+}
+
+double RandomFourierFeatures::evaluate(const VectorXd& j) const
+{
+    return scale * (frequencies * j - phases).array().cos().sum();
+}
+
+VectorXd RandomFourierFeatures::getValues(const MatrixXd& J) const
+{
+    const MatrixXd arguments = (frequencies * J).colwise() - phases;
+    return scale * arguments.array().cos().colwise().sum().transpose();
+}
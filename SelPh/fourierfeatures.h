@@ -0,0 +1,26 @@
+#ifndef FOURIERFEATURES_H
+#define FOURIERFEATURES_H
+
+#include <vector>
+#include <Eigen/Core>
+
+// Random Fourier feature approximation of the mixture f(j) = 1/N \sum_i a_i exp(- 1/2 (j - c_i)^T S_i^-1 (j - c_i)).
+// As exp(- 1/2 r^T S^-1 r) = E[cos(w^T r)] for w ~ N(0, S^-1), f(j) = A E[cos(w^T j - w^T c_i)] with
+// A = 1/N \sum_i a_i, where the kernel i is drawn with the probability proportional to a_i. The expectation
+// is replaced by the average over D samples, so a query costs O(D n) regardless of N.
+class RandomFourierFeatures
+{
+public:
+    // The whitening matrices W_i satisfy S_i^-1 = W_i^T W_i
+    RandomFourierFeatures(const std::vector<Eigen::VectorXd>& centers, const std::vector<Eigen::MatrixXd>& whitenings, const std::vector<double>& scales, unsigned nFeatures, unsigned seed = 0);
+
+    double          evaluate(const Eigen::VectorXd& j) const;
+    Eigen::VectorXd getValues(const Eigen::MatrixXd& J) const;
+
+private:
+    Eigen::MatrixXd frequencies;    // (D x n)
+    Eigen::VectorXd phases;         // w^T c for each frequency
+    double          scale;          // A / D
+};
+
+#endif // FOURIERFEATURES_H
@@ -1,9 +1,19 @@
+// #define TIME
+
 #include "goodnessfunction.h"
 
+#include <random>
+#ifdef TIME
+#include <chrono>
+#include <iostream>
+#endif
 #include <QImage>
 #include <Eigen/Dense>
+#include <parallel-util.hpp>
 #include "eigenutility.h"
 #include "image.h"
+#include "kerneltree.h"
+#include "fourierfeatures.h"
 
 using namespace std;
 using Eigen::MatrixXd;
@@ -11,44 +21,106 @@ using Eigen::VectorXd;
 
 namespace
 {
-double computeGaussian(const VectorXd& x, const VectorXd& c, const MatrixXd& S_inv)
+// (x - c)^T S^-1 (x - c) = |W (x - c)|^2, where W is lower triangular
+inline double computeSquaredMahalanobisDistance(const VectorXd& x, const VectorXd& c, const MatrixXd& W)
 {
     const unsigned n = x.rows();
-    const VectorXd r = x - c;
-    const double   a = 1.0 / sqrt(pow(2.0 * M_PI, static_cast<double>(n)) * (1.0 / S_inv.determinant()));
-    const double   b = exp(- 0.5 * r.transpose() * S_inv * r);
-    return a * b;
+    double sum = 0.0;
+    for (unsigned s = 0; s < n; ++ s)
+    {
+        double y = 0.0;
+        for (unsigned t = 0; t <= s; ++ t) y += W(s, t) * (x(t) - c(t));
+        sum += y * y;
+    }
+    return sum;
 }
 
 template<typename Scalar> Scalar clamp(Scalar x, Scalar m, Scalar M) { return std::max(std::min(x, M), m); }
+}
 
-double computeVar(const MatrixXd &w_mean, const double &o_mean, const vector<MatrixXd> &w, const VectorXd &o, unsigned s, unsigned t, unsigned N)
+template<int M, int F>
+struct GoodnessFunction::FixedSizeKernelsImpl : public GoodnessFunction::FixedSizeKernels
 {
-    double t1 = 0.0;
-    for (unsigned i = 0; i < N; ++ i)
+    enum { n = M + F };
+    typedef Eigen::Matrix<double, n, 1>                   Vector;
+    typedef Eigen::Matrix<double, n, 1, Eigen::DontAlign> StoredVector;
+    typedef Eigen::Matrix<double, n, n, Eigen::DontAlign> StoredMatrix;
+
+    struct Entry
+    {
+        StoredVector center;
+        StoredMatrix W;
+        StoredMatrix S_inv;
+        double       normalization;
+    };
+    std::vector<Entry> entries;
+
+    FixedSizeKernelsImpl(const std::vector<Kernel>& kernels)
     {
-        t1 += (o[i] * w[i](s, t) - o_mean * w_mean(s, t)) * (o[i] * w[i](s, t) - o_mean * w_mean(s, t));
+        for (const Kernel& kernel : kernels)
+        {
+            entries.push_back(Entry { kernel.center, kernel.W, kernel.S_inv, kernel.normalization });
+        }
     }
 
-    double t2 = 0.0;
-    for (unsigned i = 0; i < N; ++ i)
+    double getValue(const VectorXd& j) const override
     {
-        t2 += (o[i] - o_mean) * (o[i] * w[i](s, t) - o_mean * w_mean(s, t));
+        assert(j.rows() == n);
+        const Vector j_fixed = j;
+
+        double sum = 0.0;
+        for (const Entry& entry : entries)
+        {
+            const Vector r = j_fixed - entry.center;
+            sum += entry.normalization * exp(- 0.5 * (entry.W.template triangularView<Eigen::Lower>() * r).squaredNorm());
+        }
+        return sum / static_cast<double>(entries.size());
     }
 
-    double t3 = 0.0;
-    for (unsigned i = 0; i < N; ++ i)
+    double evaluate(const VectorXd& x, const VectorXd& f, const vector<unsigned>* indices, VectorXd* parameterGradient) const override
     {
-        t3 += (o[i] - o_mean) * (o[i] - o_mean);
-    }
+        assert(x.rows() == M && f.rows() == F);
+        Vector j;
+        j << x, f;
+
+        double sum = 0.0;
+        Eigen::Matrix<double, M, 1> gradient = Eigen::Matrix<double, M, 1>::Zero();
+        const unsigned nEvaluated = (indices != nullptr) ? indices->size() : entries.size();
+        for (unsigned k = 0; k < nEvaluated; ++ k)
+        {
+            const Entry& entry = entries[(indices != nullptr) ? (*indices)[k] : k];
+            const Vector r = j - entry.center;
+            const double g = entry.normalization * exp(- 0.5 * (entry.W.template triangularView<Eigen::Lower>() * r).squaredNorm());
+            sum += g;
 
-    return (static_cast<double>(N) / static_cast<double>(N - 1)) * (t1 - 2.0 * w_mean(s, t) * t2 + w_mean(s, t) * w_mean(s, t) * t3);
-}
-}
+            // Only the parameter part of - g * S_inv * r is needed
+            if (parameterGradient != nullptr) gradient.noalias() -= g * (entry.S_inv.template topRows<M>() * r);
+        }
+
+        if (parameterGradient != nullptr)
+        {
+            // NaN check
+            for (int s = 0; s < M; ++ s) if (std::isnan(gradient(s))) gradient(s) = 0.0;
+            *parameterGradient = gradient / static_cast<double>(entries.size());
+        }
+        return sum / static_cast<double>(entries.size());
+    }
+};
 
 GoodnessFunction::GoodnessFunction() :
     alpha(0.0020),
-    epsilon(0.020)
+    epsilon(0.020),
+    latencyBudget(0.040),
+    truncationTolerance(0.0),
+    approximationThreshold(2000),
+    nFourierFeatures(4096),
+    approximationTolerance(0.05),
+    truncationErrorBound(0.0),
+    approximationError(0.0),
+    nCovarianceUpdates(0),
+    nApproximatedUpdates(0),
+    nRejectedDataPoints(0),
+    version(0)
 {
 
 }
@@ -56,6 +128,9 @@ GoodnessFunction::GoodnessFunction() :
 // A pure implementation of the adaptive kernel density estimation algorithms described in [Talton et al. 2009] (Section 5)
 void GoodnessFunction::computeCovariance()
 {
+    ++ version;
+    ++ nCovarianceUpdates;
+
     const unsigned N = getFeatureList().size();
     const unsigned n = getFeatureList()[0].rows() + getParameterList()[0].rows();
 
@@ -71,92 +146,61 @@ void GoodnessFunction::computeCovariance()
     }
 
     // Prepare the data points
-    vector<VectorXd> x(N);
+    MatrixXd X(N, n);
     for (unsigned i = 0; i < N; ++ i)
     {
-        x[i] = getJointVector(getParameterList()[i], getFeatureList()[i]);
+        X.row(i) = getJointVector(getParameterList()[i], getFeatureList()[i]).transpose();
     }
 
-    // Compute the distances from the k-nearest neighborhoods
+    // For each Gaussian center, ...
+    // Note: with the offsets y_j = x_j - x_center and w_j = y_j y_j^T, all the sums over j in [Talton et al.
+    // 2009] are written as weighted outer-product sums Y^T diag(.) Y, so no per-sample w_j is built
     const unsigned k = std::min(N - 1, n);
-    VectorXd squaredDistance_k = VectorXd::Zero(N);
-    for (unsigned i = 0; i < N; ++ i)
+    parallelutil::parallel_for(N, [&](int center)
     {
-        vector<double> d(N);
-        for (unsigned j = 0; j < N; ++ j)
-        {
-            d[j] = (x[i] - x[j]).squaredNorm();
-        }
-        partial_sort(d.begin(), d.begin() + (k + 1), d.end());  // Note: d[0] is always 0.0
-        squaredDistance_k(i) = d[k];
-    }
+        const MatrixXd Y  = X.rowwise() - X.row(center);
+        const MatrixXd Y2 = Y.cwiseAbs2();
+        const VectorXd d  = Y2.rowwise().sum();
+
+        // Compute the distance from the k-nearest neighborhood
+        // Note: d[center] is always 0.0, so the k-th smallest value other than it is the (k + 1)-th one
+        vector<double> sorted(d.data(), d.data() + N);
+        nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+        const double squaredDistance_k = sorted[k];
 
-    // For each Gaussian center, ...
-    for (unsigned center = 0; center < N; ++ center)
-    {
         // Compute weights (omega in the paper) for this data point
-        VectorXd o = VectorXd::Zero(N);
-        for (unsigned j = 0; j < N; ++ j)
-        {
-            const double   alpha = 1.0;
-            const MatrixXd S_inv = (1.0 / (alpha * squaredDistance_k[center])) * MatrixXd::Identity(n, n);
-            o(j) = computeGaussian(x[j], x[center], S_inv);
-        }
+        // Note: the normalization factor of the isotropic Gaussian is canceled by the normalization of o
+        const double alpha = 1.0;
+        VectorXd o = (- 0.5 / (alpha * squaredDistance_k) * d).array().exp();
         o /= o.sum();
 
-        // Compute weights (w in the paper) for this data point
-        vector<MatrixXd> w(N);
-        for (unsigned j = 0; j < N; ++ j)
-        {
-            w[j] = MatrixXd::Zero(n, n);
-            for (unsigned s = 0; s < n; ++ s) for (unsigned t = s; t < n; ++ t)
-            {
-                w[j](s, t) = (x[j].row(s) - x[center].row(s)) * (x[j].row(t) - x[center].row(t));
-                w[j](t, s) = (x[j].row(s) - x[center].row(s)) * (x[j].row(t) - x[center].row(t));
-            }
-        }
-
         // Compute a covariance matrix for this data point
-        SList[center] = MatrixXd::Zero(n, n);
-        for (unsigned s = 0; s < n; ++ s) for (unsigned t = s; t < n; ++ t)
-        {
-            double elem = 0.0;
-            for (unsigned j = 0; j < N; ++ j)
-            {
-                elem += o[j] * w[j](s, t);
-            }
-            SList[center](s, t) = elem;
-            SList[center](t, s) = elem;
-        }
+        const MatrixXd Sigma = Y.transpose() * o.asDiagonal() * Y;
 
         // Compute the bandwidth shrinkage algorithm
-        const MatrixXd& Sigma = SList[center];
-
-        MatrixXd Phi = MatrixXd::Zero(n, n);
-        for (unsigned j = 0; j < n; ++ j) Phi(j, j) = Sigma(j, j);
-
+        // Note: the variance of o_j w_j(s, t) is computed for all (s, t) at once
         const MatrixXd& w_mean = Sigma;
         const double    o_mean = o.sum() / static_cast<double>(N);
+        const VectorXd  o_diff = o.array() - o_mean;
 
-        double t1 = 0.0;
-        for (unsigned s = 0; s < n; ++ s) for (unsigned t = 0; t < n; ++ t)
-        {
-            if (s == t) continue;
-            t1 += computeVar(w_mean, o_mean, w, o, s, t, N);
-        }
+        const MatrixXd S1 = Y2.transpose() * o.cwiseAbs2().asDiagonal() * Y2;
+        const MatrixXd S2 = Y.transpose() * o.cwiseProduct(o_diff).asDiagonal() * Y;
+        const MatrixXd M2 = w_mean.cwiseAbs2();
 
-        double t2 = 0.0;
-        for (unsigned s = 0; s < n; ++ s) for (unsigned t = 0; t < n; ++ t)
-        {
-            if (s == t) continue;
-            t2 += w_mean(s, t) * w_mean(s, t);
-        }
+        const MatrixXd v1  = S1 - 2.0 * o_mean * M2 + static_cast<double>(N) * o_mean * o_mean * M2;
+        const double   v3  = o_diff.squaredNorm();
+        const MatrixXd var = (static_cast<double>(N) / static_cast<double>(N - 1)) * (v1 - 2.0 * w_mean.cwiseProduct(S2) + v3 * M2);
+
+        const double t1 = var.sum() - var.diagonal().sum();
+        const double t2 = M2.sum() - M2.diagonal().sum();
 
         double lambda = t1 / t2;
         lambda = isnan(lambda) ? 0.0 : clamp(lambda, 0.0, 1.0);
 
+        const MatrixXd Phi = Sigma.diagonal().asDiagonal();
+
         SList[center] = lambda * Phi + (1.0 - lambda) * Sigma;
-    }
+    });
 }
 
 void GoodnessFunction::regularizeCovariance()
@@ -169,11 +213,179 @@ void GoodnessFunction::regularizeCovariance()
             Sigma(i, i) = max(Sigma(i, i), epsilon);
         }
     }
+
+    precomputeKernels();
+}
+
+void GoodnessFunction::precomputeKernels()
+{
+    const unsigned N = SList.size();
+    kernels.resize(N);
+    for (unsigned i = 0; i < N; ++ i)
+    {
+        const MatrixXd& S = SList[i];
+        const unsigned  n = S.rows();
+
+        // Note: S can be singular when the shrinkage does not work (e.g., very few data points); its
+        // diagonal part is used in such cases instead of producing NaN values
+        Eigen::LLT<MatrixXd> llt(S);
+        const bool isDiagonal = llt.info() != Eigen::Success;
+        if (isDiagonal) llt.compute(MatrixXd(S.diagonal().asDiagonal()));
+        const MatrixXd L = llt.matrixL();
+
+        Kernel& kernel = kernels[i];
+        kernel.center        = getJointVector(getParameterList()[i], getFeatureList()[i]);
+        kernel.W             = L.triangularView<Eigen::Lower>().solve(MatrixXd::Identity(n, n));
+        kernel.S_inv         = kernel.W.transpose() * kernel.W;
+        kernel.normalization = exp(- 0.5 * static_cast<double>(n) * log(2.0 * M_PI) - L.diagonal().array().log().sum());
+
+        // Only for the kd-tree, which needs just an upper bound of the largest eigenvalue of S: the largest
+        // absolute row sum (Gershgorin)
+        if (truncationTolerance > 0.0) kernel.maxVariance = isDiagonal ? S.diagonal().maxCoeff() : S.cwiseAbs().rowwise().sum().maxCoeff();
+        else                           kernel.maxVariance = 0.0;
+    }
+
+    // Dispatch to the fixed-size kernels if the dimensions are known
+    const unsigned m  = (N != 0) ? getParameterList()[0].rows() : 0;
+    const unsigned nf = (N != 0) ? getFeatureList()[0].rows()   : 0;
+    if      (m == 6 && nf == 5) fixedSizeKernels = make_shared<const FixedSizeKernelsImpl<6, 5>>(kernels);
+    else if (m == 3 && nf == 5) fixedSizeKernels = make_shared<const FixedSizeKernelsImpl<3, 5>>(kernels);
+    else                        fixedSizeKernels = nullptr;
+
+    updateTruncation();
+    updateApproximation();
+
+    ++ version;
+}
+
+void GoodnessFunction::updateTruncation()
+{
+    const unsigned N = kernels.size();
+
+    kernelTree           = nullptr;
+    truncationErrorBound = 0.0;
+    if (N == 0 || truncationTolerance <= 0.0) return;
+
+#ifdef TIME
+    const auto t1 = std::chrono::steady_clock::now();
+#endif
+
+    vector<VectorXd> centers(N);
+    vector<double>   scales(N);
+    vector<double>   maxVariances(N);
+    for (unsigned i = 0; i < N; ++ i)
+    {
+        centers[i]      = kernels[i].center;
+        scales[i]       = kernels[i].normalization;
+        maxVariances[i] = kernels[i].maxVariance;
+    }
+    kernelTree = make_shared<const KernelTree>(centers, scales, maxVariances);
+
+    // The bounds are relative to the largest (truncated) value in each slice as in updateApproximation
+    const unsigned nSlices = std::min(N, 16u);
+    const unsigned nPoints = 17;
+
+    VectorXd       errorBounds;
+    const VectorXd values = getTruncatedValues(generateSlices(nSlices, nPoints), &errorBounds);
+    for (unsigned s = 0; s < nSlices; ++ s)
+    {
+        const double maxValue = values.segment(s * nPoints, nPoints).maxCoeff();
+        const double maxBound = errorBounds.segment(s * nPoints, nPoints).maxCoeff();
+        truncationErrorBound = max(truncationErrorBound, maxBound / maxValue);
+    }
+
+#ifdef TIME
+    const auto t2 = std::chrono::steady_clock::now();
+    std::cout << "Truncated evaluation: " << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() << " [ms] (" << N << " data points, relative error bound: " << truncationErrorBound << ")" << std::endl;
+#endif
+}
+
+MatrixXd GoodnessFunction::generateSlices(unsigned nSlices, unsigned nPoints) const
+{
+    const unsigned N  = kernels.size();
+    const unsigned m  = getParameterList()[0].rows();
+    const unsigned nf = getFeatureList()[0].rows();
+
+    mt19937 engine(0);
+    uniform_real_distribution<double> uniform(0.0, 1.0);
+    MatrixXd J(m + nf, nSlices * nPoints);
+    for (unsigned s = 0; s < nSlices; ++ s)
+    {
+        const VectorXd& center = kernels[s * N / nSlices].center;
+        for (unsigned k = 0; k < nPoints; ++ k)
+        {
+            J.col(s * nPoints + k) = center;
+            if (k != 0) for (unsigned d = 0; d < m; ++ d) J(d, s * nPoints + k) = uniform(engine);
+        }
+    }
+    return J;
+}
+
+void GoodnessFunction::updateApproximation()
+{
+    const unsigned N = kernels.size();
+
+    if (nApproximatedUpdates == nCovarianceUpdates && (fourierFeatures != nullptr || nRejectedDataPoints != 0)) return;
+    nApproximatedUpdates = nCovarianceUpdates;
+
+    fourierFeatures    = nullptr;
+    approximationError = 0.0;
+    if (N < nRejectedDataPoints) nRejectedDataPoints = 0;
+    if (N == 0 || N < approximationThreshold || 2 * N < 3 * nRejectedDataPoints || isTruncated()) return;
+
+#ifdef TIME
+    const auto t1 = std::chrono::steady_clock::now();
+#endif
+
+    vector<VectorXd> centers(N);
+    vector<MatrixXd> whitenings(N);
+    vector<double>   scales(N);
+    for (unsigned i = 0; i < N; ++ i)
+    {
+        centers[i]    = kernels[i].center;
+        whitenings[i] = kernels[i].W;
+        scales[i]     = kernels[i].normalization;
+    }
+    const auto approximation = make_shared<const RandomFourierFeatures>(centers, whitenings, scales, nFourierFeatures);
+
+    // Measure the accuracy on the heat-map slices of (up to) 16 data points, i.e., at their own parameters and
+    // at 16 random parameter sets with their features. The error is relative to the largest exact value in
+    // each slice, since the heat-maps are normalized for each photo (see Core::localMax and localMin), and thus
+    // the noise in the low-density regions matters as much as the accuracy around the peak.
+    const unsigned nSlices = std::min(N, 16u);
+    const unsigned nPoints = 17;
+
+    const MatrixXd J      = generateSlices(nSlices, nPoints);
+    const VectorXd exact  = getValues(J);
+    const VectorXd errors = (approximation->getValues(J) - exact).cwiseAbs();
+
+    for (unsigned s = 0; s < nSlices; ++ s)
+    {
+        const double maxValue = exact.segment(s * nPoints, nPoints).maxCoeff();
+        const double maxError = errors.segment(s * nPoints, nPoints).maxCoeff();
+        approximationError = max(approximationError, maxError / maxValue);
+    }
+
+    if (approximationError <= approximationTolerance)
+    {
+        fourierFeatures     = approximation;
+        nRejectedDataPoints = 0;
+    }
+    else
+    {
+        nRejectedDataPoints = N;
+    }
+
+#ifdef TIME
+    const auto t2 = std::chrono::steady_clock::now();
+    std::cout << "Random Fourier features: " << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() << " [ms] (" << N << " data points, relative error: " << approximationError << ", " << (isApproximated() ? "used" : "not used") << ")" << std::endl;
+#endif
 }
 
 VectorXd GoodnessFunction::applyGradientAscent(const VectorXd& x, const VectorXd& f, double scale) const
 {
-    const VectorXd grad = computeGradient(x, f).block(0, 0, x.rows(), 1);
+    VectorXd grad;
+    evaluate(x, f, &grad);
     const VectorXd xNew = x + scale * alpha * grad;
 
     return getClippedParameters(xNew);
@@ -195,15 +407,13 @@ double GoodnessFunction::getValue(const VectorXd& j) const
     }
     return sum / static_cast<double>(N);
 #else
+    if (fixedSizeKernels != nullptr) return fixedSizeKernels->getValue(j);
+
     const unsigned N = getFeatureList().size();
     double sum = 0.0;
     for (unsigned i = 0; i < N; ++ i) {
-        const MatrixXd& S     = SList[i];
-        const MatrixXd  S_inv = S.inverse();
-        const VectorXd& f_i   = getFeatureList()[i];
-        const VectorXd& x_i   = getParameterList()[i];
-        const VectorXd  j_i   = getJointVector(x_i, f_i);
-        sum += computeGaussian(j, j_i, S_inv);
+        const Kernel& kernel = kernels[i];
+        sum += kernel.normalization * exp(- 0.5 * computeSquaredMahalanobisDistance(j, kernel.center, kernel.W));
     }
     return sum / static_cast<double>(N);
 #endif
@@ -211,8 +421,75 @@ double GoodnessFunction::getValue(const VectorXd& j) const
 
 double GoodnessFunction::getValue(const VectorXd& x, const VectorXd &f) const
 {
-    const VectorXd j = getJointVector(x, f);
-    return getValue(j);
+    return evaluate(x, f);
+}
+
+double GoodnessFunction::evaluate(const VectorXd& x, const VectorXd& f, VectorXd* parameterGradient) const
+{
+    if (truncationTolerance > 0.0 && kernelTree != nullptr) return evaluateTruncated(x, f, truncationTolerance, nullptr, parameterGradient);
+    if (fixedSizeKernels != nullptr) return fixedSizeKernels->evaluate(x, f, nullptr, parameterGradient);
+
+    return evaluateKernels(x, f, nullptr, parameterGradient);
+}
+
+double GoodnessFunction::evaluateTruncated(const VectorXd& x, const VectorXd& f, double tolerance, double* errorBound, VectorXd* parameterGradient) const
+{
+    assert(kernelTree != nullptr);
+
+    // Note: as each skipped kernel is at most the tolerance, the error of the average is at most the tolerance
+    vector<unsigned> indices;
+    const double skipped = kernelTree->query(getJointVector(x, f), tolerance, indices);
+    if (errorBound != nullptr) *errorBound = skipped / static_cast<double>(kernels.size());
+
+    if (fixedSizeKernels != nullptr) return fixedSizeKernels->evaluate(x, f, &indices, parameterGradient);
+
+    return evaluateKernels(x, f, &indices, parameterGradient);
+}
+
+double GoodnessFunction::evaluateKernels(const VectorXd& x, const VectorXd& f, const vector<unsigned>* indices, VectorXd* parameterGradient) const
+{
+    const unsigned m = x.rows();
+    const unsigned n = m + f.rows();
+    const unsigned N = getFeatureList().size();
+
+    double   sum = 0.0;
+    VectorXd r(n);
+    if (parameterGradient != nullptr) *parameterGradient = VectorXd::Zero(m);
+
+    const unsigned nEvaluated = (indices != nullptr) ? indices->size() : N;
+    for (unsigned k = 0; k < nEvaluated; ++ k)
+    {
+        const Kernel& kernel = kernels[(indices != nullptr) ? (*indices)[k] : k];
+        r.head(m) = x - kernel.center.head(m);
+        r.tail(n - m) = f - kernel.center.tail(n - m);
+
+        double q = 0.0;
+        for (unsigned s = 0; s < n; ++ s)
+        {
+            double y = 0.0;
+            for (unsigned t = 0; t <= s; ++ t) y += kernel.W(s, t) * r(t);
+            q += y * y;
+        }
+        const double g = kernel.normalization * exp(- 0.5 * q);
+        sum += g;
+
+        if (parameterGradient == nullptr) continue;
+
+        // Only the parameter part of - g * S_inv * r is needed
+        for (unsigned s = 0; s < m; ++ s)
+        {
+            (*parameterGradient)(s) -= g * kernel.S_inv.row(s).dot(r);
+        }
+    }
+
+    if (parameterGradient != nullptr)
+    {
+        // NaN check
+        for (unsigned s = 0; s < m; ++ s) if (std::isnan((*parameterGradient)(s))) (*parameterGradient)(s) = 0.0;
+        *parameterGradient /= static_cast<double>(N);
+    }
+
+    return sum / static_cast<double>(N);
 }
 
 VectorXd GoodnessFunction::computeGradient(const VectorXd &j) const
@@ -222,12 +499,16 @@ VectorXd GoodnessFunction::computeGradient(const VectorXd &j) const
     VectorXd sum = VectorXd::Zero(n);
     for (unsigned i = 0; i < N; ++ i)
     {
-        const MatrixXd& S     = SList[i];
-        const MatrixXd  S_inv = S.inverse();
-        const VectorXd& f_i   = getFeatureList()[i];
-        const VectorXd& x_i   = getParameterList()[i];
-        const VectorXd  j_i   = getJointVector(x_i, f_i);
-        sum += - computeGaussian(j, j_i, S_inv) * S_inv * (j - j_i);
+        const Kernel& kernel = kernels[i];
+        const double  g      = kernel.normalization * exp(- 0.5 * computeSquaredMahalanobisDistance(j, kernel.center, kernel.W));
+
+        // sum += - g * S_inv * (j - center)
+        for (unsigned s = 0; s < n; ++ s)
+        {
+            double y = 0.0;
+            for (unsigned t = 0; t < n; ++ t) y += kernel.S_inv(s, t) * (j(t) - kernel.center(t));
+            sum(s) -= g * y;
+        }
     }
 
     // NaN check
@@ -242,6 +523,82 @@ VectorXd GoodnessFunction::computeGradient(const VectorXd &x, const VectorXd &f)
     return computeGradient(j);
 }
 
+VectorXd GoodnessFunction::getValues(const MatrixXd& J, MatrixXd* gradients) const
+{
+    const unsigned n = J.rows();
+    const unsigned M = J.cols();
+    const unsigned N = getFeatureList().size();
+
+    if (isTruncated() && truncationTolerance > 0.0 && gradients == nullptr) return getTruncatedValues(J, nullptr);
+    if (fourierFeatures != nullptr && gradients == nullptr) return fourierFeatures->getValues(J);
+
+    VectorXd values = VectorXd::Zero(M);
+    if (gradients != nullptr) *gradients = MatrixXd::Zero(n, M);
+
+    const unsigned blockSize = 64;
+    const unsigned nBlocks   = (M + blockSize - 1) / blockSize;
+    parallelutil::parallel_for(nBlocks, [&](int block)
+    {
+        const unsigned begin = block * blockSize;
+        const unsigned size  = min(blockSize, M - begin);
+
+        VectorXd sum     = VectorXd::Zero(size);
+        MatrixXd gradSum = MatrixXd::Zero(n, gradients != nullptr ? size : 0);
+        for (unsigned i = 0; i < N; ++ i)
+        {
+            const Kernel&  kernel = kernels[i];
+            const MatrixXd R      = J.middleCols(begin, size).colwise() - kernel.center;
+            const MatrixXd Z      = kernel.W.triangularView<Eigen::Lower>() * R;
+            const VectorXd g      = kernel.normalization * (- 0.5 * Z.colwise().squaredNorm().transpose()).array().exp();
+
+            sum += g;
+
+            // gradSum += - S_inv * R * diag(g)
+            if (gradients != nullptr) gradSum.noalias() -= kernel.W.transpose().triangularView<Eigen::Upper>() * (Z * g.asDiagonal());
+        }
+
+        values.segment(begin, size) = sum / static_cast<double>(N);
+        if (gradients != nullptr)
+        {
+            // NaN check
+            gradSum = gradSum.unaryExpr([](double v) { return std::isnan(v) ? 0.0 : v; });
+            gradients->middleCols(begin, size) = gradSum / static_cast<double>(N);
+        }
+    });
+
+    return values;
+}
+
+VectorXd GoodnessFunction::getTruncatedValues(const MatrixXd& J, VectorXd* errorBounds) const
+{
+    const unsigned m = getParameterList()[0].rows();
+    const unsigned M = J.cols();
+
+    VectorXd values(M);
+    if (errorBounds != nullptr) errorBounds->resize(M);
+
+    // Each query visits only its own part of the kd-tree, so the queries are processed independently
+    parallelutil::parallel_for(M, [&](int k)
+    {
+        const VectorXd x = J.col(k).head(m);
+        const VectorXd f = J.col(k).tail(J.rows() - m);
+
+        double errorBound;
+        values(k) = evaluateTruncated(x, f, truncationTolerance, &errorBound);
+        if (errorBounds != nullptr) (*errorBounds)(k) = errorBound;
+    });
+
+    return values;
+}
+
+VectorXd GoodnessFunction::getValues(const MatrixXd& X, const VectorXd& f, MatrixXd* gradients) const
+{
+    MatrixXd J(X.rows() + f.rows(), X.cols());
+    J.topRows(X.rows()) = X;
+    J.bottomRows(f.rows()) = f.replicate(1, X.cols());
+    return getValues(J, gradients);
+}
+
 VectorXd GoodnessFunction::getClippedParameters(VectorXd x)
 {
     for (int i = 0; i < x.rows(); ++ i)
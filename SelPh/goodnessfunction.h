@@ -2,10 +2,13 @@
 #define GOODNESSFUNCTION_H
 
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <Eigen/Core>
 
 class Image;
+class KernelTree;
+class RandomFourierFeatures;
 
 class GoodnessFunction
 {
@@ -18,12 +21,57 @@ public:
     double getValue(const Eigen::VectorXd &x, const Eigen::VectorXd& f) const;
     Eigen::VectorXd computeGradient(const Eigen::VectorXd& j) const;
     Eigen::VectorXd computeGradient(const Eigen::VectorXd& x, const Eigen::VectorXd& f) const;
+
+    // Compute the value and (optionally) its gradient with respect to the parameters x in a single pass
+    double evaluate(const Eigen::VectorXd& x, const Eigen::VectorXd& f, Eigen::VectorXd* parameterGradient = nullptr) const;
+
+    // Evaluate only the kernels whose values can exceed the tolerance, found by a kd-tree over the kernel
+    // centers; the upper bound of the error of the value (at most the tolerance) is stored in errorBound
+    double evaluateTruncated(const Eigen::VectorXd& x, const Eigen::VectorXd& f, double tolerance, double* errorBound, Eigen::VectorXd* parameterGradient = nullptr) const;
+
+    // Evaluate many joint vectors (the columns of J) at once. Each kernel is applied to a block of queries
+    // with matrix products, and the blocks are processed in parallel. The gradients are optional.
+    Eigen::VectorXd getValues(const Eigen::MatrixXd& J, Eigen::MatrixXd* gradients = nullptr) const;
+    Eigen::VectorXd getValues(const Eigen::MatrixXd& X, const Eigen::VectorXd& f, Eigen::MatrixXd* gradients = nullptr) const;
     Eigen::VectorXd getBestParameterSet(const Eigen::VectorXd& f, bool inverse = false) const;
+    void            getBestAndWorstParameterSets(const Eigen::VectorXd& f, Eigen::VectorXd& best, Eigen::VectorXd& worst) const;
     Eigen::VectorXd getAverageParameterSet() const;
 
     const double alpha;   // for interactive optimization
     const double epsilon; // for covariance matrix regularization
 
+    // Wall-clock limit [s] of a whole getBestParameterSet (or getBestAndWorstParameterSets) call. The local
+    // solves are limited by a fixed number of evaluations, so the result is reproducible unless this deadline
+    // is reached; zero or negative disables the deadline.
+    double latencyBudget;
+
+    // If positive, evaluate (and thus getValue(x, f) and the optimization) and the batched values without
+    // gradients (i.e., getValues for the heat-maps and the start points) skip the kernels whose values cannot
+    // exceed this tolerance; the random Fourier features below are not used then. The kd-tree for this is built
+    // by regularizeCovariance only in this case. The batched gradients stay exact.
+    double truncationTolerance;
+
+    // The largest error bound of the truncated evaluation relative to the largest value, measured by
+    // regularizeCovariance on the same heat-map slices as the approximation error below; 0 when not truncated
+    double getTruncationErrorBound() const { return truncationErrorBound; }
+    bool   isTruncated()             const { return kernelTree != nullptr; }
+
+    // With this number of data points or more (and without truncation), the batched values without gradients
+    // (i.e., getValues for the heat-maps and the start points of the optimization) are approximated by
+    // nFourierFeatures random Fourier features (see fourierfeatures.h), so that a query does not depend on the
+    // number of data points. The point queries and all the gradients stay exact. The approximation is used only
+    // if its measured error is within approximationTolerance; after a rejection, it is not tried again until
+    // the number of data points has grown by half.
+    unsigned approximationThreshold;
+    unsigned nFourierFeatures;
+    double   approximationTolerance;
+
+    // The largest error of the approximation relative to the largest exact value, measured by
+    // regularizeCovariance on heat-map slices (i.e., random parameter sets in [0, 1]^m with the features of
+    // the data points); 0 when not measured
+    double getApproximationError() const { return approximationError; }
+    bool   isApproximated()        const { return fourierFeatures != nullptr; }
+
     // getter
     const std::vector<Eigen::VectorXd>& getParameterList() const { return pList; }
     const std::vector<Eigen::VectorXd>& getFeatureList() const { return fList; }
@@ -36,7 +84,81 @@ public:
     void regularizeCovariance();
     std::vector<Eigen::MatrixXd> SList;
 
+    // Incremented whenever the model is updated (i.e., by computeCovariance and regularizeCovariance)
+    unsigned getVersion() const { return version; }
+
 private:
+    // Quantities of each Gaussian kernel that do not depend on the query point; they are updated by
+    // regularizeCovariance so that a kernel evaluation is O(n^2) without any factorization
+    struct Kernel
+    {
+        Eigen::VectorXd center;         // the joint vector of the data point
+        Eigen::MatrixXd W;              // the inverse of the Cholesky factor (i.e., S^-1 = W^T W)
+        Eigen::MatrixXd S_inv;
+        double          normalization;  // 1 / sqrt((2 pi)^n det(S))
+        double          maxVariance;    // an upper bound of the largest eigenvalue of S (only for the kd-tree)
+    };
+    std::vector<Kernel> kernels;
+    void precomputeKernels();
+
+    std::shared_ptr<const KernelTree> kernelTree;
+    double                            truncationErrorBound;
+    void updateTruncation();
+
+    // The approximation is rebuilt only when the covariances have been recomputed since the last attempt
+    std::shared_ptr<const RandomFourierFeatures> fourierFeatures;
+    double                                       approximationError;
+    unsigned                                     nCovarianceUpdates;     // by computeCovariance
+    unsigned                                     nApproximatedUpdates;   // nCovarianceUpdates at the last attempt
+    unsigned                                     nRejectedDataPoints;    // N at the last rejection
+    void updateApproximation();
+
+    // The heat-map slices of (up to) nSlices data points, i.e., their own joint vectors followed by nPoints - 1
+    // random parameter sets in [0, 1]^m with their features, for measuring the errors of the evaluations
+    Eigen::MatrixXd generateSlices(unsigned nSlices, unsigned nPoints) const;
+
+    // getValues by the truncated evaluation of each query; the error bounds of the queries are optional
+    Eigen::VectorXd getTruncatedValues(const Eigen::MatrixXd& J, Eigen::VectorXd* errorBounds) const;
+
+    // Sum the kernels (all of them if indices is null)
+    double evaluateKernels(const Eigen::VectorXd& x, const Eigen::VectorXd& f, const std::vector<unsigned>* indices, Eigen::VectorXd* parameterGradient) const;
+    unsigned version;
+
+    // The kernels with fixed-size Eigen types for the known dimensions (6 + 5 and 3 + 5), which make the
+    // evaluation allocation-free and unrolled; null for the other dimensions (e.g., in the first steps)
+    struct FixedSizeKernels
+    {
+        virtual ~FixedSizeKernels() {}
+        virtual double getValue(const Eigen::VectorXd& j) const = 0;
+        virtual double evaluate(const Eigen::VectorXd& x, const Eigen::VectorXd& f, const std::vector<unsigned>* indices, Eigen::VectorXd* parameterGradient) const = 0;
+    };
+    template<int M, int F> struct FixedSizeKernelsImpl;
+    std::shared_ptr<const FixedSizeKernels> fixedSizeKernels;
+
+    // Results of getBestParameterSet for the current version of the model; a copy of the model starts empty
+    struct BestParameterSetCache
+    {
+        struct Entry
+        {
+            Eigen::VectorXd f;
+            bool            inverse;
+            Eigen::VectorXd x;
+        };
+
+        BestParameterSetCache() : version(0) {}
+        BestParameterSetCache(const BestParameterSetCache&) : version(0) {}
+        BestParameterSetCache& operator=(const BestParameterSetCache&) { return *this; }
+
+        unsigned           version;
+        std::vector<Entry> entries;
+        std::mutex         entriesMutex;
+    };
+    mutable BestParameterSetCache bestParameterSetCache;
+
+    // Search the best (or the worst if inverse) parameter sets for each element of inverses at once; the local
+    // solves of all the searches run in a single parallel loop under a single deadline
+    std::vector<Eigen::VectorXd> searchParameterSets(const Eigen::VectorXd& f, const std::vector<bool>& inverses) const;
+
     static Eigen::VectorXd getJointVector(const Eigen::VectorXd& x, const Eigen::VectorXd &f);
     static Eigen::VectorXd getClippedParameters(Eigen::VectorXd x);
 };
@@ -2,11 +2,12 @@
 
 #include "goodnessfunction.h"
 
-#include <iostream>
-#ifdef TIME
+#include <algorithm>
 #include <chrono>
-#endif
+#include <iostream>
+#include <numeric>
 #include <nlopt.hpp>
+#include <parallel-util.hpp>
 #include "eigenutility.h"
 #include "core.h"
 
@@ -27,17 +28,89 @@ double objectiveFunction(const vector<double>& x, vector<double>& grad, void* ar
     const Arg*      arg = static_cast<Arg*>(argStruct);
     const VectorXd  p   = EigenUtility::std2eigen(x);
     const VectorXd& f   = *(arg->featurePtr);
-    const VectorXd  g   = arg->functionPtr->computeGradient(p, f).block(0, 0, x.size(), 1);
 
+    if (grad.empty()) return arg->functionPtr->evaluate(p, f);
+
+    VectorXd g;
+    const double value = arg->functionPtr->evaluate(p, f, &g);
     grad = EigenUtility::eigen2std(g);
-    return arg->functionPtr->getValue(p, f);
+    return value;
+}
+
+const unsigned nHaltonPoints   = 64;    // the low-discrepancy grid for the start points
+const unsigned nMaxStarts      = 8;     // the number of local solves
+const int      nMaxEvaluations = 100;   // per local solve
+
+// The i-th point of the Halton sequence in [0, 1]^dim
+VectorXd computeHaltonPoint(unsigned i, unsigned dim)
+{
+    const unsigned primes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53 };
+    assert(dim <= sizeof(primes) / sizeof(primes[0]));
+
+    VectorXd x(dim);
+    for (unsigned d = 0; d < dim; ++ d)
+    {
+        double   value = 0.0;
+        double   scale = 1.0 / primes[d];
+        unsigned index = i;
+        while (index > 0)
+        {
+            value += scale * (index % primes[d]);
+            index /= primes[d];
+            scale /= primes[d];
+        }
+        x(d) = value;
+    }
+    return x;
 }
 
 }
 
 VectorXd GoodnessFunction::getBestParameterSet(const VectorXd &f, bool inverse) const
 {
-    Arg arg(this, &f);
+    return searchParameterSets(f, vector<bool> { inverse })[0];
+}
+
+void GoodnessFunction::getBestAndWorstParameterSets(const VectorXd& f, VectorXd& best, VectorXd& worst) const
+{
+    const vector<VectorXd> results = searchParameterSets(f, vector<bool> { false, true });
+    best  = results[0];
+    worst = results[1];
+}
+
+vector<VectorXd> GoodnessFunction::searchParameterSets(const VectorXd& f, const vector<bool>& inverses) const
+{
+    // A single deadline for the whole call, however the local solves are scheduled
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(latencyBudget);
+
+    const unsigned   nSearches = inverses.size();
+    vector<VectorXd> results(nSearches);
+
+    // Reuse the results if the same optimizations have been done for the current model
+    vector<unsigned> searches;
+    {
+        std::lock_guard<std::mutex> lock(bestParameterSetCache.entriesMutex);
+        if (bestParameterSetCache.version != version)
+        {
+            bestParameterSetCache.entries.clear();
+            bestParameterSetCache.version = version;
+        }
+        for (unsigned search = 0; search < nSearches; ++ search)
+        {
+            bool isFound = false;
+            for (const BestParameterSetCache::Entry& entry : bestParameterSetCache.entries)
+            {
+                if (entry.inverse == inverses[search] && entry.f.rows() == f.rows() && entry.f == f)
+                {
+                    results[search] = entry.x;
+                    isFound = true;
+                    break;
+                }
+            }
+            if (!isFound) searches.push_back(search);
+        }
+    }
+    if (searches.empty()) return results;
 
 #ifdef TIME
     auto t1 = std::chrono::system_clock::now();
@@ -47,49 +120,108 @@ VectorXd GoodnessFunction::getBestParameterSet(const VectorXd &f, bool inverse)
 
     const unsigned dim = getParameterList()[0].rows();
 
-    vector<double> x(dim, 0.5);
-    double value;
-
-    auto solve = [&](nlopt::opt& opt)
+    // Candidates of the start points: the center, the edited parameter sets, and a low-discrepancy grid
+    vector<VectorXd> candidates;
+    candidates.push_back(VectorXd::Constant(dim, 0.5));
+    for (const VectorXd& p : getParameterList()) candidates.push_back(p);
+    for (unsigned i = 1; i <= nHaltonPoints; ++ i) candidates.push_back(computeHaltonPoint(i, dim));
+
+    // Start from the most promising candidates for each search (evaluated at once)
+    MatrixXd X(dim, candidates.size());
+    for (unsigned i = 0; i < candidates.size(); ++ i) X.col(i) = candidates[i];
+    const VectorXd candidateValues = getValues(X, f);
+    const unsigned nStarts         = std::min<unsigned>(nMaxStarts, candidates.size());
+
+    vector<unsigned> solveSearches;
+    vector<unsigned> solveStarts;
+    for (unsigned search : searches)
     {
-        if (!inverse) {
-            opt.set_max_objective(objectiveFunction, (void*) &arg);
-        } else {
-            opt.set_min_objective(objectiveFunction, (void*) &arg);
-        }
-        opt.set_lower_bounds(0.0);
-        opt.set_upper_bounds(1.0);
-        opt.set_maxtime(0.040);
-        try
-        {
-            opt.optimize(x, value);
-        }
-        catch (nlopt::roundoff_limited e)
+        auto score = [&](unsigned i) { const double v = inverses[search] ? - candidateValues(i) : candidateValues(i); return std::isnan(v) ? - HUGE_VAL : v; };
+
+        vector<unsigned> order(candidates.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return score(a) > score(b); });
+        for (unsigned k = 0; k < nStarts; ++ k)
         {
-            std::cerr << e.what() << std::endl;
+            solveSearches.push_back(search);
+            solveStarts.push_back(order[k]);
         }
-        catch (std::runtime_error e)
+    }
+
+    // Run the local solves of all the searches in one parallel loop (so the threads are not oversubscribed);
+    // each solve gets the time left until the deadline, and the start point is kept if no time is left
+    const unsigned         nSolves = solveStarts.size();
+    vector<vector<double>> solutions(nSolves);
+    vector<double>         solutionValues(nSolves);
+    parallelutil::parallel_for(nSolves, [&](int s)
+    {
+        vector<double> x         = EigenUtility::eigen2std(candidates[solveStarts[s]]);
+        const double   remaining = std::chrono::duration<double>(deadline - std::chrono::steady_clock::now()).count();
+        if (latencyBudget <= 0.0 || remaining > 0.0)
         {
-            std::cerr << e.what() << std::endl;
+            Arg arg(this, &f);
+            nlopt::opt opt(nlopt::LD_LBFGS, dim);
+            if (!inverses[solveSearches[s]]) {
+                opt.set_max_objective(objectiveFunction, (void*) &arg);
+            } else {
+                opt.set_min_objective(objectiveFunction, (void*) &arg);
+            }
+            opt.set_lower_bounds(0.0);
+            opt.set_upper_bounds(1.0);
+            opt.set_maxeval(nMaxEvaluations);
+            if (latencyBudget > 0.0) opt.set_maxtime(remaining);
+
+            double value;
+            try
+            {
+                opt.optimize(x, value);
+            }
+            catch (nlopt::roundoff_limited& e)
+            {
+                std::cerr << e.what() << std::endl;
+            }
+            catch (std::runtime_error& e)
+            {
+                std::cerr << e.what() << std::endl;
+            }
         }
-    };
+        solutions[s]      = x;
+        solutionValues[s] = getValue(EigenUtility::std2eigen(x), f);
+    });
 
-    if (inverse)
+    // Choose the best one for each search (the earlier start wins a tie)
+    for (unsigned k = 0; k < searches.size(); ++ k)
     {
-        // Compute global optimization
-        nlopt::opt gOpt(nlopt::GD_MLSL_LDS, dim);
-        solve(gOpt);
-    }
+        const unsigned search = searches[k];
+        const bool     inverse = inverses[search];
 
-    // Compute local optimization
-    nlopt::opt lOpt(nlopt::LD_LBFGS, dim);
-    solve(lOpt);
+        unsigned best = k * nStarts;
+        for (unsigned s = best + 1; s < (k + 1) * nStarts; ++ s)
+        {
+            const bool isBetter = inverse ? solutionValues[s] < solutionValues[best] : solutionValues[s] > solutionValues[best];
+            if (isBetter || std::isnan(solutionValues[best])) best = s;
+        }
+        results[search] = EigenUtility::std2eigen(solutions[best]);
+    }
 
 #ifdef TIME
     auto t2 = std::chrono::system_clock::now();
-    auto type = inverse ? string("worst") : string("best");
-    cout << "time: " << chrono::duration_cast<chrono::milliseconds>(t2 - t1).count() << ", type: " << type << endl;
+    cout << "time: " << chrono::duration_cast<chrono::milliseconds>(t2 - t1).count() << ", searches: " << searches.size() << endl;
 #endif
 
-    return EigenUtility::std2eigen(x);
+    {
+        const unsigned maxEntries = 8;
+
+        std::lock_guard<std::mutex> lock(bestParameterSetCache.entriesMutex);
+        if (bestParameterSetCache.version == version)
+        {
+            for (unsigned search : searches)
+            {
+                if (bestParameterSetCache.entries.size() >= maxEntries) bestParameterSetCache.entries.erase(bestParameterSetCache.entries.begin());
+                bestParameterSetCache.entries.push_back(BestParameterSetCache::Entry { f, inverses[search], results[search] });
+            }
+        }
+    }
+
+    return results;
 }
@@ -0,0 +1,129 @@
+#include "heatmapcache.h"
+
+#include <QtConcurrent>
+#include <QWidget>
+#include "eigenutility.h"
+#include "goodnessfunction.h"
+
+using namespace std;
+using namespace Eigen;
+
+bool HeatMapCache::Key::operator==(const Key& other) const
+{
+    return version == other.version && width == other.width && resolution == other.resolution &&
+           f.size() == other.f.size() && x.size() == other.x.size() && f == other.f && x == other.x;
+}
+
+HeatMapCache::~HeatMapCache()
+{
+    // The worker finishes the current level and then stops
+    {
+        lock_guard<mutex> lock(resultsMutex);
+        isStopped = true;
+        isPending = false;
+        widgets.clear();
+    }
+    worker.waitForFinished();
+}
+
+void HeatMapCache::registerWidget(QWidget* widget)
+{
+    lock_guard<mutex> lock(resultsMutex);
+    widgets.insert(widget);
+}
+
+void HeatMapCache::unregisterWidget(QWidget* widget)
+{
+    lock_guard<mutex> lock(resultsMutex);
+    widgets.erase(widget);
+}
+
+shared_ptr<const HeatMapCache::Result> HeatMapCache::get(const Key& key, const shared_ptr<const GoodnessFunction>& model)
+{
+    lock_guard<mutex> lock(resultsMutex);
+
+    for (const shared_ptr<const Result>& result : results)
+    {
+        if (result->key == key && result->resolution == key.resolution) return result;
+    }
+
+    if (!(hasRequest && requestedKey == key) && !isStopped)
+    {
+        this->model  = model;
+        requestedKey = key;
+        hasRequest   = true;
+        isPending    = true;
+        if (!isRunning)
+        {
+            isRunning = true;
+            worker    = QtConcurrent::run([this]() { run(); });
+        }
+    }
+
+    for (const shared_ptr<const Result>& result : results)
+    {
+        if (result->key == key) return result;
+    }
+    return results.empty() ? nullptr : results.front();
+}
+
+void HeatMapCache::run()
+{
+    while (true)
+    {
+        Key                                key;
+        shared_ptr<const GoodnessFunction> model;
+        {
+            lock_guard<mutex> lock(resultsMutex);
+            if (!isPending)
+            {
+                isRunning = false;
+                return;
+            }
+            key       = requestedKey;
+            model     = this->model;
+            isPending = false;
+        }
+
+        const vector<int> levels = { max(key.resolution / 8, 2), max(key.resolution / 2, 2), key.resolution };
+        for (unsigned level = 0; level < levels.size(); ++ level)
+        {
+            if (level > 0 && levels[level] <= levels[level - 1]) continue;
+
+            const shared_ptr<const Result> result = compute(*model, key, levels[level]);
+            {
+                lock_guard<mutex> lock(resultsMutex);
+                results.push_front(result);
+                if (results.size() > maxResults) results.pop_back();
+                for (QWidget* widget : widgets) QMetaObject::invokeMethod(widget, "update", Qt::QueuedConnection);
+                if (isPending || isStopped) break;
+            }
+        }
+    }
+}
+
+shared_ptr<const HeatMapCache::Result> HeatMapCache::compute(const GoodnessFunction& model, const Key& key, int resolution)
+{
+    const int w   = key.width;
+    const int wid = max(w / resolution, 1);
+
+    vector<double> positions;
+    for (int i = wid / 2; i < w; i += wid) positions.push_back(static_cast<double>(i) / static_cast<double>(w - 1));
+
+    // evaluate the cells of all the sliders at once
+    const unsigned nSliders = key.x.rows();
+    const unsigned nCells   = positions.size();
+    MatrixXd X = key.x.replicate(1, nSliders * nCells);
+    for (unsigned slider = 0; slider < nSliders; ++ slider) for (unsigned k = 0; k < nCells; ++ k)
+    {
+        X(slider, slider * nCells + k) = positions[k];
+    }
+    const VectorXd values = model.getValues(X, key.f);
+
+    shared_ptr<Result> result = make_shared<Result>();
+    result->key        = key;
+    result->resolution = resolution;
+    result->positions  = EigenUtility::std2eigen(positions);
+    result->values     = Map<const MatrixXd>(values.data(), nCells, nSliders).transpose();
+    return result;
+}
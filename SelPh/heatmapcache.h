@@ -0,0 +1,70 @@
+#ifndef HEATMAPCACHE_H
+#define HEATMAPCACHE_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <Eigen/Core>
+#include <QFuture>
+
+class QWidget;
+class GoodnessFunction;
+
+// Heat-map values of all the sliders, computed by a worker in the background. A request is processed from a
+// coarse resolution to the requested one, and a newer request interrupts the refinement, so the resolution
+// adapts to how fast the requests come (e.g., coarse while dragging a slider, full when it stops). The
+// registered widgets are updated whenever a result is available. The destructor waits for the worker.
+class HeatMapCache
+{
+public:
+    struct Key
+    {
+        unsigned        version;    // of the goodness function
+        Eigen::VectorXd f;
+        Eigen::VectorXd x;
+        int             width;
+        int             resolution;
+
+        bool operator==(const Key& other) const;
+    };
+
+    struct Result
+    {
+        Key             key;
+        int             resolution; // the resolution actually computed (can be coarser than the requested one)
+        Eigen::VectorXd positions;  // the centers of the cells in [0, 1]
+        Eigen::MatrixXd values;     // (slider x cell) raw values of the goodness function
+    };
+
+    ~HeatMapCache();
+
+    void registerWidget(QWidget* widget);
+    void unregisterWidget(QWidget* widget);
+
+    // Return the best available result for the key (possibly stale or coarse) and request the computation
+    // with the model (an immutable snapshot whose version is key.version) if the key has not been computed
+    // at the full resolution yet
+    std::shared_ptr<const Result> get(const Key& key, const std::shared_ptr<const GoodnessFunction>& model);
+
+private:
+    const unsigned maxResults = 16;
+
+    std::mutex                                resultsMutex;
+    std::deque<std::shared_ptr<const Result>> results;      // the newest first
+    std::set<QWidget*>                        widgets;
+
+    std::shared_ptr<const GoodnessFunction> model;
+    Key                                     requestedKey;
+    bool                                    hasRequest = false;
+    bool                                    isPending  = false;
+    bool                                    isRunning  = false;
+    bool                                    isStopped  = false;
+    QFuture<void>                           worker;
+
+    void run();
+
+    static std::shared_ptr<const Result> compute(const GoodnessFunction& model, const Key& key, int resolution);
+};
+
+#endif // HEATMAPCACHE_H
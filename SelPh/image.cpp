@@ -1,11 +1,17 @@
 #include "image.h"
 
+#include <cmath>
 #include <enhancer/enhancer.hpp>
 #include <imagedistance.hpp>
+#include <QBuffer>
+#include <QFile>
 #include <QImage>
+#include <QImageReader>
 #include "imagemodifier.h"
+#include "channelextraction.h"
 #include "eigenutility.h"
 #include "core.h"
+#include "featurecache.h"
 
 using namespace std;
 using namespace Eigen;
@@ -14,46 +20,93 @@ namespace
 {
 Core& core = Core::getInstance();
 const unsigned previewHeight = 720;
+}
 
-void convertQImageToRgbChannels(const QImage& image,
-                                Eigen::MatrixXd* r,
-                                Eigen::MatrixXd* g,
-                                Eigen::MatrixXd* b)
+// Decode the photo directly at the preview resolution. For JPEG files, the decoder performs the
+// downscaling in the DCT domain, so the full-resolution pixels are never materialized here.
+void Image::decode(ImportTask& task)
 {
-    const int w = image.width();
-    const int h = image.height();
+    // The file is read only once for both hashing and decoding
+    // A photo that cannot be read keeps the empty hash so that it never matches the feature cache
+    QFile      file(QString::fromStdString(task.fileName));
+    const bool opened = file.open(QIODevice::ReadOnly);
+    if (!opened) cerr << "Failed to open " << task.fileName << endl;
+    QByteArray data = file.readAll();
+    file.close();
+
+    task.contentHash = opened ? FeatureCache::computeContentHash(data.constData(), data.size()) : string();
 
-    r->resize(h, w);
-    g->resize(h, w);
-    b->resize(h, w);
+    QBuffer      buffer(&data);
+    QImageReader reader(&buffer);
+    const QSize  originalSize = reader.size();
 
-    for (int x = 0; x < w; ++ x)
+    if (originalSize.isValid() && originalSize.height() > static_cast<int>(previewHeight))
     {
-        for (int y = 0; y < h; ++ y)
-        {
-            const QRgb qrgb_color = image.pixel(x, y);
-            r->coeffRef(y, x) = static_cast<double>(qRed(qrgb_color)) / 255.0;
-            g->coeffRef(y, x) = static_cast<double>(qGreen(qrgb_color)) / 255.0;
-            b->coeffRef(y, x) = static_cast<double>(qBlue(qrgb_color)) / 255.0;
-        }
+        const double scale       = static_cast<double>(previewHeight) / static_cast<double>(originalSize.height());
+        const int    scaledWidth = std::max(1, static_cast<int>(std::round(scale * static_cast<double>(originalSize.width()))));
+        reader.setScaledSize(QSize(scaledWidth, previewHeight));
     }
+
+    task.scaledQImage = make_shared<QImage>(reader.read());
+
+    // Photos with unrecognized formats are dropped beforehand (see Core), so this happens only for files that
+    // are damaged or changed after the selection; a black pixel keeps the size and the aspect ratio valid
+    if (task.scaledQImage->isNull())
+    {
+        cerr << "Failed to decode " << task.fileName << ": " << reader.errorString().toStdString() << endl;
+        task.scaledQImage = make_shared<QImage>(1, 1, QImage::Format_RGB32);
+        task.scaledQImage->fill(Qt::black);
+    }
+
+    task.originalWidth  = originalSize.isValid() ? originalSize.width()  : task.scaledQImage->width();
+    task.originalHeight = originalSize.isValid() ? originalSize.height() : task.scaledQImage->height();
 }
+
+// Only needed when the decoder could not provide the preview resolution by itself
+void Image::rescale(ImportTask& task)
+{
+    const QImage& decoded = *task.scaledQImage;
+    if (decoded.height() <= static_cast<int>(previewHeight)) return;
+    task.scaledQImage = make_shared<QImage>(decoded.scaledToHeight(previewHeight, Qt::SmoothTransformation));
+}
+
+void Image::extractChannels(ImportTask& task)
+{
+    ChannelExtraction::extractRgbChannels(*task.scaledQImage, &task.r, &task.g, &task.b);
 }
 
-Image::Image(const string &fileName) : fileName(fileName)
+void Image::computeHistogram(ImportTask& task)
 {
-    originalQImage = make_shared<QImage>(fileName.c_str());
-    scaledQImage   = make_shared<QImage>(originalQImage->scaledToHeight(min<unsigned>(previewHeight, originalQImage->height()), Qt::SmoothTransformation));
-    assert (!originalQImage->isNull());
+    task.histogram = make_shared<imagedistance::HistogramManager>(task.r, task.g, task.b, enhancer::internal::rgb2hsl);
+
+    // The channels are no longer needed
+    task.r.resize(0, 0);
+    task.g.resize(0, 0);
+    task.b.resize(0, 0);
+}
 
-    // channel extraction
-    MatrixXd r, g, b;
-    convertQImageToRgbChannels(*scaledQImage, &r, &g, &b);
+Image::Image(const string &fileName) : Image([&]()
+{
+    ImportTask task;
+    task.fileName = fileName;
+    decode(task);
+    rescale(task);
+    extractChannels(task);
+    computeHistogram(task);
+    return task;
+}())
+{
+}
 
+Image::Image(const ImportTask& task) :
+    histogram(task.histogram),
+    scaledQImage(task.scaledQImage),
+    fileName(task.fileName),
+    contentHash(task.contentHash)
+{
     // feature computation
-    histogram   = make_shared<imagedistance::HistogramManager>(r, g, b, enhancer::internal::rgb2hsl);
-    aspectRatio = static_cast<double>(originalQImage->height()) / static_cast<double>(originalQImage->width());
-    size        = static_cast<double>(originalQImage->height() * originalQImage->width()) / static_cast<double>(previewHeight * previewHeight);
+    aspectRatio = static_cast<double>(task.originalHeight) / static_cast<double>(task.originalWidth);
+    size        = static_cast<double>(task.originalHeight * task.originalWidth) / static_cast<double>(previewHeight * previewHeight);
 
     // temporary dummy vector
     featureVector = VectorXd::Zero(core.featureDim);
@@ -65,8 +118,28 @@ shared_ptr<QImage> Image::getModifiedScaledQImage(const VectorXd& x) const
     return make_shared<QImage>(img);
 }
 
+shared_ptr<imagedistance::HistogramManager> Image::getHistogram() const
+{
+    std::lock_guard<std::mutex> lock(histogramMutex);
+    if (!histogram)
+    {
+        ImportTask task;
+        task.scaledQImage = scaledQImage;
+        extractChannels(task);
+        computeHistogram(task);
+        histogram = task.histogram;
+    }
+    return histogram;
+}
+
+// The full-resolution photo is decoded on demand and kept only while the cache budget allows
+shared_ptr<QImage> Image::getOriginalQImage() const
+{
+    return core.originalImageCache.get(fileName);
+}
+
 shared_ptr<QImage> Image::getModifiedOriginalQImage(const VectorXd& x) const
 {
-    const QImage img = ImageModifier::modifyImage(*originalQImage, EigenUtility::eigen2std(x));
+    const QImage img = ImageModifier::modifyImage(*getOriginalQImage(), EigenUtility::eigen2std(x));
     return make_shared<QImage>(img);
 }
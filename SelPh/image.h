@@ -3,6 +3,7 @@
 
 #include <string>
 #include <memory>
+#include <mutex>
 #include <Eigen/Core>
 
 class QImage;
@@ -11,7 +12,26 @@ namespace imagedistance { class HistogramManager; }
 class Image
 {
 public:
+    // Intermediate products of the import pipeline (decode -> rescale -> channel extraction -> histogram).
+    // Each stage consumes the products of the previous one, so the stages can be scheduled by Core::importPhotos.
+    struct ImportTask
+    {
+        std::string                                      fileName;
+        std::string                                      contentHash;
+        int                                              originalWidth;
+        int                                              originalHeight;
+        std::shared_ptr<QImage>                          scaledQImage;
+        Eigen::MatrixXd                                  r, g, b;
+        std::shared_ptr<imagedistance::HistogramManager> histogram;
+    };
+
+    static void decode          (ImportTask& task);
+    static void rescale         (ImportTask& task);
+    static void extractChannels (ImportTask& task);
+    static void computeHistogram(ImportTask& task);
+
     Image(const std::string& fileName);
+    Image(const ImportTask& task);
 
     std::shared_ptr<QImage> getModifiedScaledQImage  (const Eigen::VectorXd& x) const;
     std::shared_ptr<QImage> getModifiedOriginalQImage(const Eigen::VectorXd& x) const;
@@ -22,9 +42,10 @@ public:
     // getter
     const Eigen::VectorXd&                           getFeatureVector()  const { assert(featureVector.rows() != 0); return featureVector; }
     std::shared_ptr<QImage>                          getScaledQImage()   const { return scaledQImage; }
-    std::shared_ptr<QImage>                          getOriginalQImage() const { return originalQImage; }
+    std::shared_ptr<QImage>                          getOriginalQImage() const;
     const std::string&                               getFileName()       const { return fileName; }
-    std::shared_ptr<imagedistance::HistogramManager> getHistogram()      const { return histogram; }
+    const std::string&                               getContentHash()    const { return contentHash; }
+    std::shared_ptr<imagedistance::HistogramManager> getHistogram()      const;
     double                                           getAspectRatio()    const { return aspectRatio; }
     double                                           getSize()           const { return size; }
 
@@ -34,10 +55,13 @@ private:
     double aspectRatio;
     double size;
 
-    std::shared_ptr<imagedistance::HistogramManager> histogram;
+    // The histogram may be skipped during the import when all the distances are found in the feature cache
+    mutable std::shared_ptr<imagedistance::HistogramManager> histogram;
+    mutable std::mutex                                       histogramMutex;
+
     std::shared_ptr<QImage>                          scaledQImage;
-    std::shared_ptr<QImage>                          originalQImage;
     std::string                                      fileName;
+    std::string                                      contentHash;
     Eigen::VectorXd                                  featureVector;   // transformed by MSD
 };
 
@@ -0,0 +1,119 @@
+#include "kerneltree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using namespace Eigen;
+using namespace std;
+
+namespace
+{
+const unsigned leafSize = 8;
+}
+
+KernelTree::KernelTree(const vector<VectorXd>& centers, const vector<double>& scales, const vector<double>& maxVariances)
+{
+    permutation.resize(centers.size());
+    iota(permutation.begin(), permutation.end(), 0);
+    if (centers.empty()) return;
+
+    build(centers, scales, maxVariances, 0, centers.size());
+
+    sortedCenters.resize(centers[0].rows(), centers.size());
+    sortedScales.resize(centers.size());
+    sortedMaxVariances.resize(centers.size());
+    for (unsigned k = 0; k < centers.size(); ++ k)
+    {
+        sortedCenters.col(k)  = centers[permutation[k]];
+        sortedScales(k)       = scales[permutation[k]];
+        sortedMaxVariances(k) = maxVariances[permutation[k]];
+    }
+}
+
+int KernelTree::build(const vector<VectorXd>& centers, const vector<double>& scales, const vector<double>& maxVariances, unsigned begin, unsigned end)
+{
+    const int index = nodes.size();
+    nodes.push_back(Node());
+
+    Node node;
+    node.lower       = centers[permutation[begin]];
+    node.upper       = centers[permutation[begin]];
+    node.maxScale    = 0.0;
+    node.maxVariance = 0.0;
+    node.begin       = begin;
+    node.end         = end;
+    node.children[0] = node.children[1] = -1;
+    for (unsigned k = begin; k < end; ++ k)
+    {
+        const unsigned i = permutation[k];
+        node.lower       = node.lower.cwiseMin(centers[i]);
+        node.upper       = node.upper.cwiseMax(centers[i]);
+        node.maxScale    = max(node.maxScale, scales[i]);
+        node.maxVariance = max(node.maxVariance, maxVariances[i]);
+    }
+
+    // Split at the median of the widest dimension
+    if (end - begin > leafSize)
+    {
+        int dim;
+        (node.upper - node.lower).maxCoeff(&dim);
+
+        const unsigned middle = (begin + end) / 2;
+        nth_element(permutation.begin() + begin, permutation.begin() + middle, permutation.begin() + end, [&](unsigned a, unsigned b)
+        {
+            return centers[a](dim) < centers[b](dim);
+        });
+
+        node.children[0] = build(centers, scales, maxVariances, begin, middle);
+        node.children[1] = build(centers, scales, maxVariances, middle, end);
+    }
+
+    nodes[index] = node;
+    return index;
+}
+
+double KernelTree::query(const VectorXd& j, double tolerance, vector<unsigned>& indices) const
+{
+    indices.clear();
+    if (nodes.empty()) return 0.0;
+
+    double skipped = 0.0;
+
+    vector<int> stack(1, 0);
+    while (!stack.empty())
+    {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+
+        // The upper bound of the value of each kernel in this node
+        const double d2    = (j.cwiseMax(node.lower).cwiseMin(node.upper) - j).squaredNorm();
+        const double bound = node.maxScale * exp(- 0.5 * d2 / node.maxVariance);
+        if (bound <= tolerance)
+        {
+            skipped += bound * static_cast<double>(node.end - node.begin);
+            continue;
+        }
+
+        if (node.children[0] < 0)
+        {
+            for (unsigned k = node.begin; k < node.end; ++ k)
+            {
+                const double kernelBound = sortedScales(k) * exp(- 0.5 * (sortedCenters.col(k) - j).squaredNorm() / sortedMaxVariances(k));
+                if (kernelBound <= tolerance)
+                {
+                    skipped += kernelBound;
+                }
+                else
+                {
+                    indices.push_back(permutation[k]);
+                }
+            }
+            continue;
+        }
+        stack.push_back(node.children[1]);
+        stack.push_back(node.children[0]);
+    }
+
+    return skipped;
+}
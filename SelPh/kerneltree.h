@@ -0,0 +1,44 @@
+#ifndef KERNELTREE_H
+#define KERNELTREE_H
+
+#include <vector>
+#include <Eigen/Core>
+
+// A kd-tree over the centers of Gaussian kernels g_i(j) = a_i exp(- 1/2 (j - c_i)^T S_i^-1 (j - c_i)). As
+// (j - c_i)^T S_i^-1 (j - c_i) >= |j - c_i|^2 / lambda_max(S_i), a node bounds the values of all its kernels
+// by the largest a_i and lambda_max(S_i) and the distance from the query to its bounding box. In a leaf, the
+// bound of each kernel is checked with its own a_i, lambda_max(S_i) and center. Any upper bound of
+// lambda_max(S_i) can be given instead (the bounds only become looser).
+class KernelTree
+{
+public:
+    KernelTree(const std::vector<Eigen::VectorXd>& centers, const std::vector<double>& scales, const std::vector<double>& maxVariances);
+
+    // Collect the kernels whose values at j can exceed the tolerance. The sum of the upper bounds of the
+    // values of the other (skipped) kernels is returned.
+    double query(const Eigen::VectorXd& j, double tolerance, std::vector<unsigned>& indices) const;
+
+private:
+    struct Node
+    {
+        Eigen::VectorXd lower;
+        Eigen::VectorXd upper;
+        double          maxScale;
+        double          maxVariance;
+        unsigned        begin;      // the range in the permuted kernel indices
+        unsigned        end;
+        int             children[2];
+    };
+
+    std::vector<Node>     nodes;
+    std::vector<unsigned> permutation;
+
+    // In the permuted order
+    Eigen::MatrixXd sortedCenters;
+    Eigen::VectorXd sortedScales;
+    Eigen::VectorXd sortedMaxVariances;
+
+    int build(const std::vector<Eigen::VectorXd>& centers, const std::vector<double>& scales, const std::vector<double>& maxVariances, unsigned begin, unsigned end);
+};
+
+#endif // KERNELTREE_H
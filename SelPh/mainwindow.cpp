@@ -42,7 +42,9 @@ namespace
 
 MainWindow::MainWindow(QWidget *parent) :
 QMainWindow(parent),
-ui(new Ui::MainWindow)
+ui(new Ui::MainWindow),
+importDialog(nullptr),
+heatMapCache(make_shared<HeatMapCache>())
 {
     ui->setupUi(this);
     core.mainWindow = this;
@@ -84,6 +86,14 @@ ui(new Ui::MainWindow)
 
     // initialize images
     QProgressDialog dialog(QString("Loading image files..."), QString(), 0, 0, this);
+    dialog.setAutoReset(false);
+    importDialog = &dialog;
+
+    // The photos keep being ingested in background after the dialog is closed (in the streaming mode)
+    core.importProgressCallback = [this](unsigned nIngested, unsigned nPhotos)
+    {
+        QMetaObject::invokeMethod(this, "updateImportProgress", Qt::QueuedConnection, Q_ARG(int, static_cast<int>(nIngested)), Q_ARG(int, static_cast<int>(nPhotos)));
+    };
     QFutureWatcher<void> watcher;
     QObject::connect(&watcher, SIGNAL(finished()), &dialog, SLOT(reset()));
     watcher.setFuture(QtConcurrent::run([dirPath] ()
@@ -92,9 +102,10 @@ ui(new Ui::MainWindow)
                                         }));
     dialog.exec();
     watcher.waitForFinished();
+    importDialog = nullptr;
 
     // status bar
-    ui->statusBar->showMessage(QString::number(core.currentIndex + 1) + QString(" / ") + QString::number(core.images.size()));
+    updateStatusBar();
 
     // finalize
     this->adjustSize();
@@ -110,6 +121,9 @@ ui(new Ui::MainWindow)
 
 MainWindow::~MainWindow()
 {
+    // Stop the background ingestion before this window (which receives its progress) is destroyed
+    core.cancelIngestion();
+
     delete ui;
 }
 
@@ -176,6 +190,35 @@ void MainWindow::updateConfidenceValueInUI(double confidence)
     }
 }
 
+void MainWindow::updateStatusBar()
+{
+    QString message = QString::number(core.currentIndex + 1) + QString(" / ") + QString::number(core.images.size());
+
+    const unsigned nIngested = core.getNumIngestedImages();
+    if (nIngested < core.images.size())
+    {
+        message += QString(" (importing: ") + QString::number(nIngested) + QString(" / ") + QString::number(core.images.size()) + QString(")");
+    }
+
+    // The bound is relative to the peak of a heat-map slice (see GoodnessFunction::getTruncationErrorBound)
+    const shared_ptr<const GoodnessFunction> model = core.getGoodnessFunctionSnapshot();
+    if (model->isTruncated())
+    {
+        message += QString(" (truncation error: < ") + QString::number(100.0 * model->getTruncationErrorBound(), 'g', 2) + QString("%)");
+    }
+    ui->statusBar->showMessage(message);
+}
+
+void MainWindow::updateImportProgress(int nIngested, int nPhotos)
+{
+    if (importDialog != nullptr)
+    {
+        importDialog->setMaximum(nPhotos);
+        importDialog->setValue(nIngested);
+    }
+    updateStatusBar();
+}
+
 void MainWindow::updateParametersBySlider()
 {
     // detect focused slider
@@ -225,7 +268,7 @@ void MainWindow::updateParametersBySlider()
     // refresh
     for (shared_ptr<VisualizationWidget> vw : visualizationWidgets)
     {
-        vw->repaint();
+        vw->update();
     }
     core.previewWidget->repaint();
 }
@@ -324,7 +367,7 @@ void MainWindow::generateSliderComponent(const string& name, const int index, co
     QObject::connect(l.get(), SIGNAL(editingFinished()), this, SLOT(updateParametersByText()));
 
     // generate a visualization widget
-    shared_ptr<VisualizationWidget> w = make_shared<VisualizationWidget>(this, index);
+    shared_ptr<VisualizationWidget> w = make_shared<VisualizationWidget>(this, index, heatMapCache);
 
     // register them
     sliders.push_back(s);
@@ -355,7 +398,7 @@ void MainWindow::on_checkBox_vis_clicked()
     core.useVisualization = ui->checkBox_vis->isChecked();
     for (shared_ptr<VisualizationWidget> vw : visualizationWidgets)
     {
-        vw->repaint();
+        vw->update();
     }
 }
 
@@ -364,7 +407,7 @@ void MainWindow::on_checkBox_opt_clicked()
     core.useOptimization = ui->checkBox_opt->isChecked();
     for (shared_ptr<VisualizationWidget> vw : visualizationWidgets)
     {
-        vw->repaint();
+        vw->update();
     }
 }
 
@@ -398,7 +441,7 @@ void MainWindow::on_nextButton_clicked()
     ui->scrollArea_reference->ensureVisible(0, 0);
 
     // status bar
-    ui->statusBar->showMessage(QString::number(core.currentIndex + 1) + QString(" / ") + QString::number(core.images.size()));
+    updateStatusBar();
 
     // Re-enable updating widgets
     window()->setUpdatesEnabled(true);
@@ -407,7 +450,7 @@ void MainWindow::on_nextButton_clicked()
     core.previewWidget->repaint();
     for (shared_ptr<VisualizationWidget> vw : visualizationWidgets)
     {
-        vw->repaint();
+        vw->update();
     }
 }
 
@@ -429,10 +472,39 @@ void MainWindow::on_pushButton_auto_clicked()
     core.previewWidget->repaint();
     for (shared_ptr<VisualizationWidget> vw : visualizationWidgets)
     {
-        vw->repaint();
+        vw->update();
     }
 }
 
+void MainWindow::on_actionAdd_photos_triggered()
+{
+    const QStringList fileNames = QFileDialog::getOpenFileNames(this, tr("Add Photos"), QString(), tr("Photos (*.jpg *.JPG)"));
+    if (fileNames.isEmpty()) return;
+
+    vector<string> filePaths;
+    for (const QString& fileName : fileNames) filePaths.push_back(fileName.toStdString());
+
+    // The containers are extended here on the GUI thread, and the new photos are ingested in background
+    core.addPhotos(filePaths);
+
+    if (!core.useStreamingImport)
+    {
+        const unsigned n = core.images.size();
+
+        shared_ptr<QProgressDialog> dialog = make_shared<QProgressDialog>(QString("Adding photos..."), QString(), 0, 0, this);
+        QFutureWatcher<void> watcher;
+        QObject::connect(&watcher, SIGNAL(finished()), dialog.get(), SLOT(reset()));
+        watcher.setFuture(QtConcurrent::run([n] ()
+                                            {
+                                                core.waitForIngestion(n);
+                                            }));
+        dialog->exec();
+        watcher.waitForFinished();
+    }
+
+    updateStatusBar();
+}
+
 void MainWindow::on_actionExport_transformed_feature_coordinates_triggered()
 {
     core.printFeatureCoordinates();
@@ -6,7 +6,9 @@
 #include <QSlider>
 #include <QLineEdit>
 #include <QTimer>
+#include <QProgressDialog>
 #include "visualizationwidget.h"
+#include "heatmapcache.h"
 
 namespace Ui
 {
@@ -30,6 +32,7 @@ public:
 public slots:
     void updateParametersBySlider();
     void updateParametersByText();
+    void updateImportProgress(int nIngested, int nPhotos);
 
 private slots:
     void on_checkBox_vis_clicked();
@@ -41,6 +44,7 @@ private slots:
     void on_actionExport_transformed_feature_coordinates_triggered();
     void on_actionRestart_timer_triggered();
     void on_actionDisable_functions_triggered();
+    void on_actionAdd_photos_triggered();
 
 protected:
     void keyPressEvent(QKeyEvent* event);
@@ -48,6 +52,9 @@ protected:
 private:
     Ui::MainWindow *ui;
     void initializeSliders();
+    void updateStatusBar();
+
+    QProgressDialog* importDialog;
 
     std::vector<std::shared_ptr<QImage>> referenceImages;
     void clearReferenceLayout();
@@ -55,6 +62,9 @@ private:
 
     void generateSliderComponent(const std::string &name, const int index, const bool last = false);
 
+    // Note: declared before the widgets so that its worker is stopped after they are destroyed
+    std::shared_ptr<HeatMapCache> heatMapCache;
+
     std::vector<std::shared_ptr<QSlider>>             sliders;
     std::vector<std::shared_ptr<QLineEdit>>           edits;
     std::vector<std::shared_ptr<VisualizationWidget>> visualizationWidgets;
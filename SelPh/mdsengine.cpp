@@ -0,0 +1,199 @@
+#include "mdsengine.h"
+
+#include <cassert>
+#include <random>
+#include <Eigen/Eigenvalues>
+#include <Eigen/QR>
+
+using namespace Eigen;
+using namespace std;
+
+namespace
+{
+const unsigned nOversampling   = 10;    // the number of extra basis vectors for faster convergence
+const unsigned nMaxIterations  = 10;    // give up the iteration and use the dense solver beyond this
+const unsigned filterDegree    = 8;     // the number of products with B per iteration
+const unsigned denseThreshold  = 64;    // the dense solver is cheap enough for small n
+const double   tolerance       = 1e-6;  // relative to the largest eigenvalue
+
+MatrixXd orthonormalize(const MatrixXd& V)
+{
+    return HouseholderQR<MatrixXd>(V).householderQ() * MatrixXd::Identity(V.rows(), V.cols());
+}
+
+MatrixXd computeCoordinates(const VectorXd& eigenvalues, const MatrixXd& eigenvectors)
+{
+    return eigenvalues.cwiseMax(0.0).cwiseSqrt().asDiagonal() * eigenvectors.transpose();
+}
+}
+
+MdsEngine::MdsEngine() :
+    nIterations(0)
+{
+}
+
+void MdsEngine::setDistances(const DistanceTensor& distance, const VectorXd& alpha, unsigned n)
+{
+    this->alpha = alpha;
+
+    const VectorXd d = distance.computeWeightedDistances(alpha, n);
+    D.resize(n, n);
+    for (unsigned j = 0; j < n; ++ j)
+    {
+        D(j, j) = 0.0;
+        for (unsigned i = 0; i < j; ++ i)
+        {
+            const double d_ij = d(DistanceTensor::getPairIndex(i, j));
+            D(i, j) = D(j, i) = d_ij * d_ij;
+        }
+    }
+}
+
+MatrixXd MdsEngine::multiplyB(const MatrixXd& V) const
+{
+    const MatrixXd U = V.rowwise() - V.colwise().mean();
+    MatrixXd W = D * U;
+    W.rowwise() -= W.colwise().mean();
+    return - 0.5 * W;
+}
+
+// The squared Frobenius norm of B (i.e., the sum of its squared eigenvalues) in a single pass over D, using
+// B_ij = -1/2 (D_ij - r_i - r_j + g), where r is the vector of the row means of D and g is the mean of r
+double MdsEngine::computeSquaredNorm() const
+{
+    const VectorXd r = D.rowwise().mean();
+    const double   g = r.mean();
+
+    double sum = 0.0;
+    for (unsigned j = 0; j < D.cols(); ++ j)
+    {
+        sum += (D.col(j).array() - r.array() - (r(j) - g)).square().sum();
+    }
+    return 0.25 * sum;
+}
+
+// Apply the Chebyshev polynomial of the degree filterDegree that is bounded by one in [lower, upper] and
+// grows rapidly above upper (where the wanted eigenvalues are). BV is B V, which is already known.
+MatrixXd MdsEngine::applyChebyshevFilter(const MatrixXd& V, const MatrixXd& BV, double lower, double upper) const
+{
+    const double c = 0.5 * (upper + lower);
+    const double e = 0.5 * (upper - lower);
+
+    MatrixXd Y0 = V;
+    MatrixXd Y1 = (BV - c * V) / e;
+    for (unsigned k = 2; k <= filterDegree; ++ k)
+    {
+        MatrixXd Y2 = (2.0 / e) * (multiplyB(Y1) - c * Y1) - Y0;
+        Y0.swap(Y1);
+        Y1.swap(Y2);
+    }
+    return Y1;
+}
+
+MatrixXd MdsEngine::computeDense(unsigned dim)
+{
+    const unsigned n = D.rows();
+    const unsigned m = min(n, dim + nOversampling);
+    const MatrixXd B = multiplyB(MatrixXd::Identity(n, n));
+    const SelfAdjointEigenSolver<MatrixXd> solver(0.5 * (B + B.transpose()));
+
+    // Note: the eigenvalues are sorted in increasing order
+    Q           = solver.eigenvectors().rightCols(m).rowwise().reverse();
+    eigenvalues = solver.eigenvalues().tail(dim).reverse();
+    return computeCoordinates(eigenvalues, Q.leftCols(dim));
+}
+
+bool MdsEngine::computeIterative(unsigned dim, MatrixXd& Y)
+{
+    const unsigned n = D.rows();
+    const unsigned m = min(n, dim + nOversampling);
+
+    // Initial basis: the previous basis (the new photos get random entries) plus random columns
+    mt19937 engine(0);
+    normal_distribution<double> normal(0.0, 1.0 / sqrt(static_cast<double>(n)));
+    MatrixXd V(n, m);
+    for (unsigned j = 0; j < m; ++ j) for (unsigned i = 0; i < n; ++ i)
+    {
+        V(i, j) = (i < static_cast<unsigned>(Q.rows()) && j < static_cast<unsigned>(Q.cols())) ? Q(i, j) : normal(engine);
+    }
+    V = orthonormalize(V);
+
+    // The smallest eigenvalue is bounded by the energy that the Ritz values leave: the k-th largest Ritz value
+    // is at most the k-th largest eigenvalue (by interlacing), so lambda_min^2 <= ||B||_F^2 - \sum_{theta_k > 0} theta_k^2
+    const double squaredNorm = computeSquaredNorm();
+    double       lower       = - sqrt(squaredNorm);
+
+    for (nIterations = 1; nIterations <= nMaxIterations; ++ nIterations)
+    {
+        const MatrixXd BV = multiplyB(V);
+
+        // Rayleigh-Ritz projection (the eigenvalues are sorted in decreasing order)
+        const MatrixXd H = V.transpose() * BV;
+        const SelfAdjointEigenSolver<MatrixXd> solver(0.5 * (H + H.transpose()));
+        const VectorXd theta = solver.eigenvalues().reverse();
+        const MatrixXd S     = solver.eigenvectors().rowwise().reverse();
+
+        const MatrixXd ritzVectors = V * S;
+        const MatrixXd residuals   = BV * S - ritzVectors * theta.asDiagonal();
+
+        const double scale = max(theta.cwiseAbs().maxCoeff(), 1e-12);
+        if (residuals.leftCols(dim).colwise().norm().maxCoeff() <= tolerance * scale)
+        {
+            Q           = ritzVectors;
+            eigenvalues = theta.head(dim);
+            Y           = computeCoordinates(eigenvalues, ritzVectors.leftCols(dim));
+            return true;
+        }
+
+        // Damp the eigenvalues below the smallest Ritz value (which approximates the largest unwanted one)
+        const double upper = theta(m - 1);
+        lower = max(lower, - sqrt(max(squaredNorm - theta.cwiseMax(0.0).squaredNorm(), 0.0)));
+        V = orthonormalize((upper > lower) ? applyChebyshevFilter(ritzVectors, BV * S, lower, upper) : MatrixXd(BV * S));
+    }
+    return false;
+}
+
+MatrixXd MdsEngine::compute(unsigned dim)
+{
+    const unsigned n = D.rows();
+
+    MatrixXd Y;
+    if (n <= denseThreshold || !computeIterative(dim, Y))
+    {
+        Y = computeDense(dim);
+        nIterations = 0;
+    }
+
+    // The signs of the eigenvectors are arbitrary; keep them consistent with the previous step
+    const unsigned nCommon = min<unsigned>(n, X.cols());
+    for (unsigned k = 0; k < min<unsigned>(dim, X.rows()); ++ k)
+    {
+        if (Y.row(k).head(nCommon).dot(X.row(k).head(nCommon)) < 0.0) Y.row(k) *= - 1.0;
+    }
+    X     = Y;
+    means = D.colwise().mean().transpose();
+
+    return Y;
+}
+
+VectorXd MdsEngine::embed(const DistanceTensor& distance, unsigned index) const
+{
+    const unsigned n = X.cols();
+    assert(index >= n);
+
+    VectorXd delta2(n);
+    for (unsigned i = 0; i < n; ++ i)
+    {
+        const double d = alpha.dot(distance.getPair(DistanceTensor::getPairIndex(i, index)));
+        delta2(i) = d * d;
+    }
+
+    // Note: X = sqrt(Lambda) V^T, so the division by lambda_k yields the above formula
+    VectorXd x = X * (means - delta2);
+    for (unsigned k = 0; k < x.rows(); ++ k)
+    {
+        x(k) = (eigenvalues(k) > 0.0) ? 0.5 * x(k) / eigenvalues(k) : 0.0;
+    }
+    return x;
+}
+
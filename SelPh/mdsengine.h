@@ -0,0 +1,55 @@
+#ifndef MDSENGINE_H
+#define MDSENGINE_H
+
+#include <Eigen/Core>
+#include "distancetensor.h"
+
+// Classical MDS that computes only the top eigenpairs of the double-centered matrix
+// B = -1/2 J D J (J = I - 1 1^T / n) by Chebyshev-filtered subspace iteration with Rayleigh-Ritz
+// projections. B is never formed; its products are computed from the squared distance matrix D by
+// centering. As the learned distances are not Euclidean in general, B is indefinite and plain subspace
+// iteration would also be attracted by its negative eigenvalues; the filter instead damps the whole
+// interval [lambda_min, theta_m] of the unwanted eigenvalues, where theta_m is the smallest Ritz value of the
+// basis and lambda_min is bounded from below by the part of ||B||_F^2 not explained by the positive Ritz
+// values (a guaranteed bound, so no negative eigenvalue is left outside the damped interval). The basis of
+// the previous step is reused as the initial guess.
+class MdsEngine
+{
+public:
+    MdsEngine();
+
+    // Set the learned squared distances among the first n photos (all of them are recomputed, since alpha
+    // changes in every step)
+    void setDistances(const DistanceTensor& distance, const Eigen::VectorXd& alpha, unsigned n);
+
+    // Compute the (dim x n) coordinates. Negative eigenvalues are clamped to zero.
+    Eigen::MatrixXd compute(unsigned dim);
+
+    // Place a photo that is not in the MDS problem (index >= n) by the Nystrom out-of-sample extension
+    // x_k = 1 / (2 sqrt(lambda_k)) \sum_i v_{i, k} (mu_i - delta_i^2), where delta_i is its learned
+    // distance to the i-th photo and mu_i is the mean squared distance of the i-th photo. O(k n).
+    Eigen::VectorXd embed(const DistanceTensor& distance, unsigned index) const;
+
+    unsigned getNumIterations() const { return nIterations; }
+
+private:
+    Eigen::MatrixXd D;
+    Eigen::VectorXd alpha;
+
+    // The Ritz basis and the coordinates of the previous step (for warm starting)
+    Eigen::MatrixXd Q;
+    Eigen::MatrixXd X;
+
+    // For the out-of-sample extension
+    Eigen::VectorXd eigenvalues;
+    Eigen::VectorXd means;
+    unsigned        nIterations;
+
+    Eigen::MatrixXd multiplyB(const Eigen::MatrixXd& V) const;
+    double          computeSquaredNorm() const;
+    Eigen::MatrixXd applyChebyshevFilter(const Eigen::MatrixXd& V, const Eigen::MatrixXd& BV, double lower, double upper) const;
+    Eigen::MatrixXd computeDense(unsigned dim);
+    bool            computeIterative(unsigned dim, Eigen::MatrixXd& Y);
+};
+
+#endif // MDSENGINE_H
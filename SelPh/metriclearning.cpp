@@ -2,104 +2,165 @@
 
 #include "metriclearning.h"
 
+#include <iostream>
 #ifdef TIME
 #include <chrono>
 #endif
-#include <nlopt.hpp>
-#include "core.h"
-#include "eigenutility.h"
+#include <Eigen/Cholesky>
+#include <parallel-util.hpp>
 
 using namespace Eigen;
 using namespace std;
 
 namespace
 {
-Core& core = Core::getInstance();
+const double weight = 5.0;
 }
 
 namespace MetricLearning
 {
 
-struct Arg
+NormalEquations::NormalEquations() :
+    G(MatrixXd::Zero(DistanceTensor::dim, DistanceTensor::dim)),
+    b(VectorXd::Zero(DistanceTensor::dim)),
+    c(0.0),
+    nData(0)
 {
-    Arg(const Core::Distance* D_images, const MatrixXd* D_params, unsigned nData) : D_images(D_images), D_params(D_params), nData(nData) {}
-    const Core::Distance* D_images;
-    const MatrixXd*       D_params;
-    const unsigned        nData;
-};
+}
 
-///////////////////////////////////////////////////////////////////////////////////////////////
-// \grad(C) = \sum_{i, j} \grad { \| D_images_{i, j}^T \alpha - D_params_{i, j} \|^2 }
-//          = - 2 \sum_{i, j} D_images_{i, j} ( D_params_{i, j} - D_images_{i, j}^T \alpha )
-///////////////////////////////////////////////////////////////////////////////////////////////
-Eigen::VectorXd computeGradient(const VectorXd& alpha, const Arg* data, const double weight)
+void NormalEquations::update(const DistanceTensor& D_images, const vector<VectorXd>& params)
 {
-    VectorXd grad = VectorXd::Zero(alpha.rows());
-    for (unsigned i = 0; i < data->nData; ++ i) for (unsigned j = i + 1; j < data->nData; ++ j)
+    const unsigned n = params.size();
+    if (n <= nData) return;
+
+    // The new pairs (i, j) for nData <= j < n are contiguous in the distance tensor
+    const size_t begin  = DistanceTensor::getNumPairs(nData);
+    const size_t nPairs = DistanceTensor::getNumPairs(n) - begin;
+    const auto   D_new  = D_images.getPairs(n).middleCols(begin, nPairs);
+
+    VectorXd D_params_new(nPairs);
+    for (unsigned j = nData; j < n; ++ j) for (unsigned i = 0; i < j; ++ i)
     {
-        const VectorXd D_ij = EigenUtility::std2eigen((*data->D_images)[i][j]);
-        grad += D_ij * (weight * data->D_params->coeff(i, j) - D_ij.transpose() * alpha);
+        D_params_new(DistanceTensor::getPairIndex(i, j) - begin) = (params[i] - params[j]).norm();
     }
-    grad = - 2.0 * grad;
-    return grad;
-}
 
-///////////////////////////////////////////////////////////////////////////////////////////////
-// C = \sum_{i, j} { \| D_images_{i, j}^T \alpha - D_params_{i, j} \|^2 }
-///////////////////////////////////////////////////////////////////////////////////////////////
-double objectiveFunction(const vector<double> &x, vector<double>& grad, void* argData)
-{
-    const Arg*     data   = static_cast<const Arg*>(argData);
-    const VectorXd alpha  = EigenUtility::std2eigen(x);
-    const double   weight = 5.0;
+    // Partial sums of the blocks
+    const size_t blockSize = 1024;
+    const size_t nBlocks   = (nPairs + blockSize - 1) / blockSize;
+
+    vector<MatrixXd> G_blocks(nBlocks);
+    vector<VectorXd> b_blocks(nBlocks);
+    vector<double>   c_blocks(nBlocks);
 
-    // Compute the function value
-    double cost = 0.0;
-    for (unsigned i = 0; i < data->nData; ++ i) for (unsigned j = i + 1; j < data->nData; ++ j)
+    parallelutil::parallel_for(nBlocks, [&](int block)
     {
-        const double d = Core::computeDistance(alpha, *(data->D_images), i, j) - weight * data->D_params->coeff(i, j);
-        cost += d * d;
-    }
+        const size_t blockBegin = block * blockSize;
+        const size_t size       = min(blockSize, nPairs - blockBegin);
+        const auto   D_block    = D_new.middleCols(blockBegin, size);
+        const auto   p_block    = D_params_new.segment(blockBegin, size);
 
-    // Compute the gradient
-    grad = EigenUtility::eigen2std(computeGradient(alpha, data, weight));
+        G_blocks[block].noalias() = D_block * D_block.transpose();
+        b_blocks[block].noalias() = D_block * p_block;
+        c_blocks[block]           = p_block.squaredNorm();
+    });
 
-    return cost;
+    for (size_t block = 0; block < nBlocks; ++ block)
+    {
+        G += G_blocks[block];
+        b += b_blocks[block];
+        c += c_blocks[block];
+    }
+    nData = n;
 }
 
-VectorXd computeMetricLearning(const vector<vector<vector<double>>> &D_images, const MatrixXd &D_params, const VectorXd &seed, unsigned nData)
+double NormalEquations::computeCost(const VectorXd& alpha, VectorXd* grad) const
 {
-    const unsigned dim = seed.rows();
-
-    vector<double> x = EigenUtility::eigen2std(seed);
-    double value;
-
-    const Arg argData(&D_images, &D_params, nData);
+    const VectorXd G_alpha = G * alpha;
+    if (grad != nullptr) *grad = 2.0 * (G_alpha - weight * b);
+    return alpha.dot(G_alpha) - 2.0 * weight * b.dot(alpha) + weight * weight * c;
+}
 
-    // Compute local optimization
-    nlopt::opt localOpt(nlopt::LD_LBFGS, dim);
-    localOpt.set_min_objective(objectiveFunction, (void*) &argData);
-    localOpt.set_lower_bounds(0.0);
-    try
-    {
-#ifdef TIME
-        const auto t1 = chrono::system_clock::now();
-#endif
-        localOpt.optimize(x, value);
+///////////////////////////////////////////////////////////////////////////////////////////////
+// The active set method by [Lawson and Hanson 1974] applied to
+//   minimize \alpha^T G \alpha - 2 w b^T \alpha subject to \alpha >= 0.
+// A tiny ridge is added to G so that the solution is unique even when there are fewer pairs
+// than the dimension (i.e., at the first few edits).
+///////////////////////////////////////////////////////////////////////////////////////////////
+VectorXd computeMetricLearning(const NormalEquations& equations)
+{
 #ifdef TIME
-        const auto t2 = chrono::system_clock::now();
-        cout << "Metric learning: " << chrono::duration_cast<chrono::milliseconds>(t2 - t1).count() << " [ms]" << endl;
+    const auto t1 = chrono::system_clock::now();
 #endif
-    }
-    catch (const nlopt::roundoff_limited e)
+
+    const unsigned dim = equations.G.rows();
+    const double   tol = 1e-12 * max(1.0, equations.G.diagonal().maxCoeff());
+
+    const MatrixXd G = equations.G + 1e-10 * max(1e-12, equations.G.trace() / dim) * MatrixXd::Identity(dim, dim);
+    const VectorXd r = weight * equations.b;
+
+    VectorXd     alpha   = VectorXd::Zero(dim);
+    vector<bool> passive(dim, false);
+
+    // Solve the unconstrained problem on the passive set
+    auto solvePassive = [&]()
     {
-        cerr << e.what() << endl;
-    }
-    catch (const std::runtime_error e)
+        vector<unsigned> indices;
+        for (unsigned i = 0; i < dim; ++ i) if (passive[i]) indices.push_back(i);
+
+        MatrixXd G_P(indices.size(), indices.size());
+        VectorXd r_P(indices.size());
+        for (unsigned k = 0; k < indices.size(); ++ k)
+        {
+            r_P(k) = r(indices[k]);
+            for (unsigned l = 0; l < indices.size(); ++ l) G_P(k, l) = G(indices[k], indices[l]);
+        }
+        const VectorXd s_P = G_P.ldlt().solve(r_P);
+
+        VectorXd s = VectorXd::Zero(dim);
+        for (unsigned k = 0; k < indices.size(); ++ k) s(indices[k]) = s_P(k);
+        return s;
+    };
+
+    for (unsigned iter = 0; iter < 3 * dim; ++ iter)
     {
-        cerr << e.what() << endl;
+        // Find the most promising variable among the active (i.e., zero-clamped) ones
+        const VectorXd descent = r - G * alpha;
+        int    best      = -1;
+        double bestValue = tol;
+        for (unsigned i = 0; i < dim; ++ i)
+        {
+            if (!passive[i] && descent(i) > bestValue) { best = i; bestValue = descent(i); }
+        }
+        if (best < 0) break;
+        passive[best] = true;
+
+        // Move toward the unconstrained solution while keeping the feasibility
+        VectorXd s = solvePassive();
+        for (unsigned inner = 0; inner < dim; ++ inner)
+        {
+            double step = 1.0;
+            for (unsigned i = 0; i < dim; ++ i)
+            {
+                if (passive[i] && s(i) <= 0.0) step = min(step, alpha(i) / (alpha(i) - s(i)));
+            }
+            if (step >= 1.0) break;
+
+            alpha += step * (s - alpha);
+            for (unsigned i = 0; i < dim; ++ i)
+            {
+                if (passive[i] && alpha(i) <= tol) { passive[i] = false; alpha(i) = 0.0; }
+            }
+            s = solvePassive();
+        }
+        alpha = s;
     }
 
-    return EigenUtility::std2eigen(x);
+#ifdef TIME
+    const auto t2 = chrono::system_clock::now();
+    cout << "Metric learning: " << chrono::duration_cast<chrono::milliseconds>(t2 - t1).count() << " [ms], cost: " << equations.computeCost(alpha) << endl;
+#endif
+
+    return alpha;
 }
+
 }
@@ -3,10 +3,41 @@
 
 #include <Eigen/Core>
 #include <vector>
+#include "distancetensor.h"
 
 namespace MetricLearning
 {
-Eigen::VectorXd computeMetricLearning(const std::vector<std::vector<std::vector<double>>> &D_images, const Eigen::MatrixXd& D_params, const Eigen::VectorXd& seed, unsigned nData);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+// The cost C = \sum_{i, j} { \| D_images_{i, j}^T \alpha - w D_params_{i, j} \|^2 } is a quadratic
+// function of \alpha, so it is summarized by the following statistics over the pairs:
+//   G = \sum_{i, j} D_images_{i, j} D_images_{i, j}^T
+//   b = \sum_{i, j} D_params_{i, j} D_images_{i, j}
+//   c = \sum_{i, j} D_params_{i, j}^2
+// such that C = \alpha^T G \alpha - 2 w b^T \alpha + w^2 c. An edited photo adds only the pairs
+// between it and the previously edited photos, so the statistics are updated incrementally.
+///////////////////////////////////////////////////////////////////////////////////////////////
+struct NormalEquations
+{
+    NormalEquations();
+
+    // Accumulate the pairs of the parameter sets that have not been accumulated yet. The new pairs are
+    // processed in fixed-size blocks in parallel, and the partial sums of the blocks are reduced in the
+    // block order so that the result does not depend on the number of threads.
+    void update(const DistanceTensor& D_images, const std::vector<Eigen::VectorXd>& params);
+
+    // Compute the cost and (optionally) its gradient together
+    double computeCost(const Eigen::VectorXd& alpha, Eigen::VectorXd* grad = nullptr) const;
+
+    Eigen::MatrixXd G;
+    Eigen::VectorXd b;
+    double          c;
+    unsigned        nData;
+};
+
+// Solve the non-negative least squares problem directly from the normal equations
+Eigen::VectorXd computeMetricLearning(const NormalEquations& equations);
+
 }
 
 #endif // METRICLEARNING_H
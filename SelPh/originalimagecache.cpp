@@ -0,0 +1,146 @@
+#include "originalimagecache.h"
+
+#include <cassert>
+#include <iostream>
+#include <QImage>
+
+using std::size_t;
+using std::string;
+using std::shared_ptr;
+using std::make_shared;
+using std::lock_guard;
+using std::mutex;
+
+namespace
+{
+inline size_t computeBytes(const QImage& image)
+{
+    return static_cast<size_t>(image.bytesPerLine()) * static_cast<size_t>(image.height());
+}
+}
+
+OriginalImageCache::OriginalImageCache(unsigned capacity, size_t budget) :
+    capacity(capacity),
+    budget(budget),
+    usage(0),
+    nHits(0),
+    nMisses(0),
+    nEvictions(0)
+{
+}
+
+shared_ptr<QImage> OriginalImageCache::get(const string& fileName)
+{
+    {
+        lock_guard<mutex> lock(entriesMutex);
+        const auto it = lookup.find(fileName);
+        if (it != lookup.end())
+        {
+            // Move the entry to the front
+            entries.splice(entries.begin(), entries, it->second);
+            ++ nHits;
+            return it->second->second;
+        }
+        ++ nMisses;
+    }
+
+    // Decode without blocking the other users of the cache
+    const shared_ptr<QImage> image = make_shared<QImage>(fileName.c_str());
+    assert (!image->isNull());
+
+    lock_guard<mutex> lock(entriesMutex);
+
+    // Another thread may have decoded the same photo in the meantime
+    const auto it = lookup.find(fileName);
+    if (it != lookup.end())
+    {
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    // Photos larger than the whole budget are not cached at all
+    const size_t bytes = computeBytes(*image);
+    if (capacity == 0 || bytes > budget) return image;
+
+    evict(capacity - 1, budget - bytes);
+    entries.push_front(Entry(fileName, image));
+    lookup[fileName] = entries.begin();
+    usage += bytes;
+
+    return image;
+}
+
+void OriginalImageCache::evict(unsigned targetCount, size_t targetBytes)
+{
+    while ((entries.size() > targetCount || usage > targetBytes) && !entries.empty())
+    {
+        usage -= computeBytes(*entries.back().second);
+        lookup.erase(entries.back().first);
+        entries.pop_back();
+        ++ nEvictions;
+    }
+}
+
+void OriginalImageCache::setCapacity(unsigned capacity)
+{
+    lock_guard<mutex> lock(entriesMutex);
+    this->capacity = capacity;
+    evict(capacity, budget);
+}
+
+unsigned OriginalImageCache::getCapacity() const
+{
+    lock_guard<mutex> lock(entriesMutex);
+    return capacity;
+}
+
+void OriginalImageCache::setBudget(size_t budget)
+{
+    lock_guard<mutex> lock(entriesMutex);
+    this->budget = budget;
+    evict(capacity, budget);
+}
+
+size_t OriginalImageCache::getBudget() const
+{
+    lock_guard<mutex> lock(entriesMutex);
+    return budget;
+}
+
+size_t OriginalImageCache::getUsage() const
+{
+    lock_guard<mutex> lock(entriesMutex);
+    return usage;
+}
+
+void OriginalImageCache::clear()
+{
+    lock_guard<mutex> lock(entriesMutex);
+    entries.clear();
+    lookup.clear();
+    usage = 0;
+}
+
+unsigned long OriginalImageCache::getNumHits() const
+{
+    lock_guard<mutex> lock(entriesMutex);
+    return nHits;
+}
+
+unsigned long OriginalImageCache::getNumMisses() const
+{
+    lock_guard<mutex> lock(entriesMutex);
+    return nMisses;
+}
+
+unsigned long OriginalImageCache::getNumEvictions() const
+{
+    lock_guard<mutex> lock(entriesMutex);
+    return nEvictions;
+}
+
+void OriginalImageCache::printStatistics() const
+{
+    lock_guard<mutex> lock(entriesMutex);
+    std::cout << "Original image cache: " << nHits << " hits, " << nMisses << " misses, " << nEvictions << " evictions, " << entries.size() << " / " << capacity << " photos, " << (usage >> 20) << " / " << (budget >> 20) << " [MB]" << std::endl;
+}
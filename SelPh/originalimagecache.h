@@ -0,0 +1,56 @@
+#ifndef ORIGINALIMAGECACHE_H
+#define ORIGINALIMAGECACHE_H
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class QImage;
+
+// A least-recently-used cache of full-resolution photos. Photos are decoded on demand and evicted
+// when more than capacity photos are kept or the total size of the decoded pixels exceeds the byte
+// budget. Each photo is typically opened once when it is exported, so by default only the current
+// and the previous photos are kept.
+class OriginalImageCache
+{
+public:
+    OriginalImageCache(unsigned capacity = 2, std::size_t budget = std::size_t(256) << 20);
+
+    std::shared_ptr<QImage> get(const std::string& fileName);
+
+    void        setCapacity(unsigned capacity);
+    unsigned    getCapacity() const;
+    void        setBudget(std::size_t budget);
+    std::size_t getBudget() const;
+    std::size_t getUsage()  const;
+    void        clear();
+
+    // statistics
+    unsigned long getNumHits()      const;
+    unsigned long getNumMisses()    const;
+    unsigned long getNumEvictions() const;
+    void          printStatistics() const;
+
+private:
+    typedef std::pair<std::string, std::shared_ptr<QImage>> Entry;
+
+    void evict(unsigned capacity, std::size_t budget);
+
+    unsigned    capacity;
+    std::size_t budget;
+    std::size_t usage;
+
+    std::list<Entry>                                               entries; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator>    lookup;
+
+    unsigned long nHits;
+    unsigned long nMisses;
+    unsigned long nEvictions;
+
+    mutable std::mutex entriesMutex;
+};
+
+#endif // ORIGINALIMAGECACHE_H
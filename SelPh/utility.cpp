@@ -17,6 +17,11 @@ string getTemporaryDirectory()
     return QCoreApplication::applicationDirPath().toStdString() + "/../StudyData";
 }
 
+string getCacheDirectory()
+{
+    return QCoreApplication::applicationDirPath().toStdString() + "/../Cache";
+}
+
 vector<string> getPhotoFileList(string dirPath)
 {
     QDir path(dirPath.c_str());
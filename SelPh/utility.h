@@ -8,6 +8,7 @@ namespace Utility {
 
 std::string getResourceDirectory();
 std::string getTemporaryDirectory();
+std::string getCacheDirectory();
 std::vector<std::string> getPhotoFileList(std::string dirPath);
 
 }
@@ -1,12 +1,14 @@
 #include "visualizationwidget.h"
 
 #include <iostream>
+#include <memory>
 #include <QPainter>
 #include <QPaintEvent>
 #include <QVector3D>
 #include <tinycolormap.hpp>
 #include "core.h"
 #include "eigenutility.h"
+#include "heatmapcache.h"
 
 using namespace std;
 using namespace Eigen;
@@ -15,12 +17,19 @@ namespace {
 Core& core = Core::getInstance();
 }
 
-VisualizationWidget::VisualizationWidget(QWidget *parent, int index) :
-    QWidget(parent)
+VisualizationWidget::VisualizationWidget(QWidget *parent, int index, std::shared_ptr<HeatMapCache> heatMapCache) :
+    QWidget(parent),
+    heatMapCache(heatMapCache)
 {
     this->index = index;
     this->setMinimumHeight(core.getSizeOfVisualizationHeight());
     this->setMaximumHeight(core.getSizeOfVisualizationHeight());
+    if (heatMapCache != nullptr) heatMapCache->registerWidget(this);
+}
+
+VisualizationWidget::~VisualizationWidget()
+{
+    if (heatMapCache != nullptr) heatMapCache->unregisterWidget(this);
 }
 
 void VisualizationWidget::paintEvent(QPaintEvent *event)
@@ -42,18 +51,27 @@ void VisualizationWidget::paintEvent(QPaintEvent *event)
     painter.fillRect(event->rect(), background);
 
     // if not visualization mode
-    if (!core.useVisualization) {
+    if (!core.useVisualization || heatMapCache == nullptr) {
         painter.end();
         return;
     }
 
     // gradation
-    int res = core.gradationResolution;
-    int wid = w / res;
-    vector<double> x = core.getParameters();
-    for (int i = wid / 2; i < w; i += wid) {
-        x[index] = static_cast<double>(i) / static_cast<double>(w - 1);
-        double value = core.goodnessFunction.getValue(EigenUtility::std2eigen(x), core.getCurrentFeatureVector());
+    // Note: the values are computed in the background; the latest available ones are shown until then
+    const shared_ptr<const GoodnessFunction> model = core.getGoodnessFunctionSnapshot();
+    HeatMapCache::Key key;
+    key.version    = model->getVersion();
+    key.f          = core.getCurrentFeatureVector();
+    key.x          = EigenUtility::std2eigen(core.getParameters());
+    key.width      = w;
+    key.resolution = core.gradationResolution;
+    const shared_ptr<const HeatMapCache::Result> result = heatMapCache->get(key, model);
+
+    const int nCells = (result != nullptr) ? result->positions.rows() : 0;
+    const int wid    = (result != nullptr) ? w / result->resolution : 0;
+    for (int k = 0; k < nCells; ++ k) {
+        const int i = static_cast<int>(result->positions(k) * static_cast<double>(w - 1));
+        double value = result->values(index, k);
 
         // regularize the value into [0, 1]
         value = (value - core.localMin) / (core.localMax - core.localMin);
@@ -1,13 +1,17 @@
 #ifndef VISUALIZATIONWIDGET_H
 #define VISUALIZATIONWIDGET_H
 
+#include <memory>
 #include <QWidget>
 
+class HeatMapCache;
+
 class VisualizationWidget : public QWidget
 {
     Q_OBJECT
 public:
-    explicit VisualizationWidget(QWidget *parent = 0, int index = -1);
+    explicit VisualizationWidget(QWidget *parent = 0, int index = -1, std::shared_ptr<HeatMapCache> heatMapCache = nullptr);
+    ~VisualizationWidget();
 
 signals:
     
@@ -18,6 +22,9 @@ protected:
 
 private:
     int index;
+
+    // Shared by all the sliders (and owned by the main window)
+    std::shared_ptr<HeatMapCache> heatMapCache;
     
 };
 